@@ -0,0 +1,614 @@
+#ifndef __M_BINARY_SINK_H__
+#define __M_BINARY_SINK_H__
+
+/*  二进制日志文件
+    1. 落地方向BinaryFileSink直接接收原始日志记录, 不做任何格式化, 按紧凑的二进制格式写入文件
+    2. 调用点(文件名 + 行号 + 格式化字符串)/日志器名称/线程ID只在第一次出现时写入一次字典帧, 日志帧中只记录编号
+    3. 离线工具通过BinaryReader读取文件, 还原出日志消息后可以使用任意格式化规则进行输出
+
+    文件由若干帧组成: [类型(1字节)][帧长度(varint)][帧数据]
+        HEAD:   "TJQBLOG" + 版本号, 每次打开文件都会写入, 读取时遇到HEAD帧则清空所有字典
+        SITE:   [编号][行号][记录类型][文件名长度][文件名][格式化字符串长度][格式化字符串]
+        LOGGER: [编号][日志器名称]
+        THREAD: [编号][std::thread::id原始字节]
+        LOG:    [时间差(zigzag)][等级(1字节)][线程编号][日志器编号][调用点编号][负载]
+                负载: 文本类型的调用点为[长度][消息], 否则为按照格式化字符串依次写入的紧凑参数
+                负载之后到帧末尾为结构化字段块(见Fields.hpp), 没有字段则为空
+    整数均使用varint编码, 有符号整数先进行zigzag编码; 浮点数按原始字节写入; 字符串为[长度 + 1][数据 + '\0'], 空指针长度记为0
+*/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cassert>
+#include <cstring>
+#include <unordered_map>
+#include "Tool.hpp"
+#include "Sink.hpp"
+#include "Buffer.hpp"
+#include "Record.hpp"
+
+namespace tjq
+{
+    namespace binary
+    {
+        enum FrameType : uint8_t
+        {
+            HEAD = 1,
+            SITE = 2,
+            LOGGER = 3,
+            THREAD = 4,
+            LOG = 5
+        };
+
+        static const char MAGIC[] = "TJQBLOG";
+        static const uint8_t VERSION = 1;
+
+        inline void putVarint(Buffer &out, uint64_t val)
+        {
+            char *ptr = out.reserve(10);
+            size_t len = 0;
+            while (val >= 0x80)
+            {
+                ptr[len++] = (char)(val | 0x80);
+                val >>= 7;
+            }
+            ptr[len++] = (char)val;
+            out.moveWriter(len);
+        }
+
+        inline bool getVarint(const char *&ptr, const char *end, uint64_t &val)
+        {
+            val = 0;
+            for (int shift = 0; ptr < end && shift < 64; shift += 7)
+            {
+                uint8_t byte = (uint8_t)*ptr++;
+                val |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline uint64_t zigzag(int64_t val)
+        {
+            return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+        }
+
+        inline int64_t unzigzag(uint64_t val)
+        {
+            return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+        }
+
+        // 转码读取器: 从日志记录中取出参数的同时, 以紧凑格式写入out
+        class ArgEncoder
+        {
+        public:
+            ArgEncoder(const char *args, Buffer &out)
+                : _in(args),
+                  _out(out)
+            {
+            }
+            int64_t getSigned()
+            {
+                int64_t val = _in.getSigned();
+                putVarint(_out, zigzag(val));
+                return val;
+            }
+            uint64_t getUnsigned()
+            {
+                uint64_t val = _in.getUnsigned();
+                putVarint(_out, val);
+                return val;
+            }
+            double getDouble()
+            {
+                double val = _in.getDouble();
+                _out.push((const char *)&val, sizeof(val));
+                return val;
+            }
+            long double getLongDouble()
+            {
+                long double val = _in.getLongDouble();
+                _out.push((const char *)&val, sizeof(val));
+                return val;
+            }
+            void *getPointer()
+            {
+                void *val = _in.getPointer();
+                putVarint(_out, (uint64_t)(uintptr_t)val);
+                return val;
+            }
+            const char *getString()
+            {
+                const char *str = _in.getString();
+                if (str == nullptr)
+                {
+                    putVarint(_out, 0);
+                    return str;
+                }
+                size_t len = strlen(str);
+                putVarint(_out, len + 1);
+                _out.push(str, len + 1);
+                return str;
+            }
+
+        private:
+            Record::ArgReader _in;
+            Buffer &_out;
+        };
+
+        // 读取紧凑格式的参数, 与ArgEncoder一一对应; 数据不完整时返回0值/空字符串并标记错误
+        class ArgDecoder
+        {
+        public:
+            ArgDecoder(const char *ptr, const char *end)
+                : _ptr(ptr),
+                  _end(end),
+                  _bad(false)
+            {
+            }
+            int64_t getSigned()
+            {
+                return unzigzag(getUnsigned());
+            }
+            uint64_t getUnsigned()
+            {
+                uint64_t val = 0;
+                if (getVarint(_ptr, _end, val) == false)
+                {
+                    _bad = true;
+                }
+                return val;
+            }
+            double getDouble()
+            {
+                return getRaw<double>();
+            }
+            long double getLongDouble()
+            {
+                return getRaw<long double>();
+            }
+            void *getPointer()
+            {
+                return (void *)(uintptr_t)getUnsigned();
+            }
+            const char *getString()
+            {
+                uint64_t len = getUnsigned();
+                if (len == 0)
+                {
+                    return nullptr;
+                }
+                if (len > (uint64_t)(_end - _ptr) || _ptr[len - 1] != '\0')
+                {
+                    _bad = true;
+                    _ptr = _end;
+                    return "";
+                }
+                const char *str = _ptr;
+                _ptr += len;
+                return str;
+            }
+            bool bad()
+            {
+                return _bad;
+            }
+            // 已经读取的参数之后的位置(结构化字段块的起始位置)
+            const char *position() const
+            {
+                return _ptr;
+            }
+
+        private:
+            template <typename T>
+            T getRaw()
+            {
+                T val = 0;
+                if ((size_t)(_end - _ptr) < sizeof(T))
+                {
+                    _bad = true;
+                    _ptr = _end;
+                    return val;
+                }
+                memcpy(&val, _ptr, sizeof(T));
+                _ptr += sizeof(T);
+                return val;
+            }
+
+        private:
+            const char *_ptr;
+            const char *_end;
+            bool _bad;
+        };
+
+        // 只取参数, 不关心格式化结果
+        struct NullVisitor
+        {
+            void text(const char *data, size_t len)
+            {
+            }
+            template <typename T>
+            void arg(const char *spec, int nstars, const int *stars, T val)
+            {
+            }
+        };
+    }
+
+    /*  落地方向: 二进制日志文件
+        BinaryFileSink(const std::string &pathname, const FlushPolicy &policy);
+        pathname: 文件名
+        policy: 持久化策略(默认不主动刷新)
+        只接收原始日志记录, 使用logdecode工具将文件还原为文本日志
+    */
+    class BinaryFileSink : public LogSink
+    {
+    public:
+        BinaryFileSink(const std::string &pathname, const FlushPolicy &policy = FlushPolicy())
+            : _pathname(pathname),
+              _policy(policy),
+              _file(policy),
+              _last_stamp(0)
+        {
+            // 创建并打开日志文件, 写入文件头, 之后的字典从头开始编号
+            _file.open(_pathname);
+            _body.push(binary::MAGIC, sizeof(binary::MAGIC) - 1);
+            _body.push((const char *)&binary::VERSION, 1);
+            writeFrame(binary::HEAD);
+        }
+
+        // 二进制日志文件不接收格式化后的字符串
+        void log(const char *data, size_t len)
+        {
+        }
+        void flush(bool force) override
+        {
+            _file.flush(force);
+        }
+        bool needRecord() override
+        {
+            return true;
+        }
+        void logRecord(const std::string &logger, const RecordHeader &hdr, const char *body) override
+        {
+            uint64_t site = siteId(hdr, body);
+            uint64_t logger_id = loggerId(logger);
+            uint64_t thread = threadId(hdr._tid);
+            // 时间差: 多个线程的日志记录不一定严格按时间排列, 使用zigzag编码
+            binary::putVarint(_body, binary::zigzag((int64_t)(hdr._stamp - _last_stamp)));
+            _last_stamp = hdr._stamp;
+            _body.push((const char *)&hdr._level, 1);
+            binary::putVarint(_body, thread);
+            binary::putVarint(_body, logger_id);
+            binary::putVarint(_body, site);
+            if (hdr._kind == RecordKind::TEXT)
+            {
+                binary::putVarint(_body, hdr._len);
+                _body.push(body, hdr._len);
+            }
+            else
+            {
+                binary::ArgEncoder args(Record::args(hdr, body), _body);
+                binary::NullVisitor visitor;
+                Record::walk(body, hdr._len, args, visitor);
+            }
+            std::string_view block = Record::fields(hdr, body);
+            _body.push(block.data(), block.size());
+            writeFrame(binary::LOG);
+        }
+        // 分片写入 pathname.index, 每个分段都是完整的二进制日志文件, 可以由logdecode按时间合并还原
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<BinaryFileSink>(_pathname + "." + std::to_string(index), _policy);
+        }
+
+    private:
+        // 调用点: 调用点对象是静态的, 直接比较指针; 同一调用点可能使用不同的格式化字符串
+        struct Site
+        {
+            const CallSite *_site;
+            RecordKind _kind;
+            std::string _fmt;
+            uint64_t _id;
+        };
+
+        uint64_t siteId(const RecordHeader &hdr, const char *body)
+        {
+            std::string_view fmt = hdr._kind == RecordKind::ARGS ? std::string_view(body, hdr._len) : std::string_view();
+            size_t hash = std::hash<std::string_view>()(fmt) ^ std::hash<const void *>()(hdr._site) ^ (size_t)hdr._kind;
+            std::vector<Site> &sites = _sites[hash];
+            for (auto &site : sites)
+            {
+                if (site._site == hdr._site && site._kind == hdr._kind && site._fmt == fmt)
+                {
+                    return site._id;
+                }
+            }
+            uint64_t id = _site_count++;
+            sites.push_back(Site{hdr._site, hdr._kind, std::string(fmt), id});
+            // 字典帧: 文本类型调用点的格式化字符串记为空
+            size_t file_len = strlen(hdr._site->_file);
+            binary::putVarint(_body, id);
+            binary::putVarint(_body, hdr._site->_line);
+            binary::putVarint(_body, (uint8_t)hdr._kind);
+            binary::putVarint(_body, file_len);
+            _body.push(hdr._site->_file, file_len);
+            binary::putVarint(_body, fmt.size());
+            _body.push(fmt.data(), fmt.size());
+            writeFrame(binary::SITE);
+            return id;
+        }
+
+        uint64_t loggerId(const std::string &logger)
+        {
+            auto it = _loggers.find(logger);
+            if (it != _loggers.end())
+            {
+                return it->second;
+            }
+            uint64_t id = _loggers.size();
+            _loggers.insert(std::make_pair(logger, id));
+            binary::putVarint(_body, id);
+            _body.push(logger.c_str(), logger.size());
+            writeFrame(binary::LOGGER);
+            return id;
+        }
+
+        uint64_t threadId(std::thread::id tid)
+        {
+            auto it = _threads.find(tid);
+            if (it != _threads.end())
+            {
+                return it->second;
+            }
+            uint64_t id = _threads.size();
+            _threads.insert(std::make_pair(tid, id));
+            binary::putVarint(_body, id);
+            _body.push((const char *)&tid, sizeof(tid));
+            writeFrame(binary::THREAD);
+            return id;
+        }
+
+        // 将_body作为一帧写入文件
+        void writeFrame(binary::FrameType type)
+        {
+            _frame.reset();
+            _frame.push((const char *)&type, 1);
+            binary::putVarint(_frame, _body.readAbleSize());
+            _frame.push(_body.begin(), _body.readAbleSize());
+            _body.reset();
+            _file.write(_frame.begin(), _frame.readAbleSize());
+        }
+
+    private:
+        std::string _pathname;
+        FlushPolicy _policy;
+        LogFile _file;
+        uint64_t _last_stamp;
+        uint64_t _site_count = 0;
+        std::unordered_map<size_t, std::vector<Site>> _sites;
+        std::unordered_map<std::string, uint64_t> _loggers;
+        std::unordered_map<std::thread::id, uint64_t> _threads;
+        Buffer _body;  // 当前帧的数据
+        Buffer _frame; // 帧头 + 帧数据
+    };
+
+    /*  二进制日志文件的读取
+        BinaryReader reader(data, len);
+        while (reader.next(entry)) { LogMessage msg(...); formatter.format(out, msg); }
+    */
+    class BinaryReader
+    {
+    public:
+        // 一条还原后的日志, 其中的字符串引用文件数据或读取器内部缓冲区, 在下一次调用next之前有效
+        struct Entry
+        {
+            uint64_t _stamp;
+            LogLevel::value _level;
+            size_t _line;
+            std::thread::id _tid;
+            std::string_view _file;
+            std::string_view _logger;
+            std::string_view _payload;
+            std::string_view _fields;
+        };
+
+        BinaryReader(const char *data, size_t len)
+            : _ptr(data),
+              _end(data + len),
+              _last_stamp(0),
+              _bad(false)
+        {
+        }
+
+        // 读取下一条日志, 文件结束或者数据损坏时返回false
+        bool next(Entry &entry)
+        {
+            while (_ptr < _end)
+            {
+                uint8_t type = (uint8_t)*_ptr++;
+                uint64_t len = 0;
+                if (binary::getVarint(_ptr, _end, len) == false || len > (uint64_t)(_end - _ptr))
+                {
+                    _bad = true;
+                    return false;
+                }
+                const char *body = _ptr, *end = _ptr + len;
+                _ptr = end;
+                bool ret = true;
+                switch (type)
+                {
+                case binary::HEAD:
+                    ret = readHead(body, end);
+                    break;
+                case binary::SITE:
+                    ret = readSite(body, end);
+                    break;
+                case binary::LOGGER:
+                    ret = readName(body, end, _loggers);
+                    break;
+                case binary::THREAD:
+                    ret = readThread(body, end);
+                    break;
+                case binary::LOG:
+                    if (readLog(body, end, entry))
+                        return true;
+                    ret = false;
+                    break;
+                default: // 未知类型的帧直接跳过
+                    break;
+                }
+                if (ret == false)
+                {
+                    _bad = true;
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        // 读取是否因为数据损坏而结束
+        bool bad()
+        {
+            return _bad;
+        }
+
+    private:
+        struct Site
+        {
+            size_t _line;
+            RecordKind _kind;
+            std::string_view _file;
+            std::string_view _fmt;
+        };
+
+        // 写入端从0开始连续编号, 新编号只能紧跟已有字典, 防止损坏的编号撑大字典
+        template <typename T>
+        static bool extend(std::vector<T> &dict, uint64_t id)
+        {
+            if (id > dict.size())
+            {
+                return false;
+            }
+            if (id == dict.size())
+            {
+                dict.emplace_back();
+            }
+            return true;
+        }
+
+        bool readHead(const char *ptr, const char *end)
+        {
+            size_t len = sizeof(binary::MAGIC) - 1;
+            if ((size_t)(end - ptr) < len + 1 || memcmp(ptr, binary::MAGIC, len) != 0 || (uint8_t)ptr[len] != binary::VERSION)
+            {
+                return false;
+            }
+            _sites.clear();
+            _loggers.clear();
+            _threads.clear();
+            _last_stamp = 0;
+            return true;
+        }
+
+        bool readSite(const char *ptr, const char *end)
+        {
+            uint64_t id, line, kind, file_len, fmt_len;
+            if (!binary::getVarint(ptr, end, id) || !binary::getVarint(ptr, end, line) || !binary::getVarint(ptr, end, kind) ||
+                !binary::getVarint(ptr, end, file_len) || file_len > (uint64_t)(end - ptr))
+            {
+                return false;
+            }
+            std::string_view file(ptr, file_len);
+            ptr += file_len;
+            if (!binary::getVarint(ptr, end, fmt_len) || fmt_len != (uint64_t)(end - ptr))
+            {
+                return false;
+            }
+            // 记录类型和格式化字符串都来自文件, 必须重新校验后才能交给snprintf
+            if ((kind != (uint64_t)RecordKind::TEXT && kind != (uint64_t)RecordKind::ARGS) || Record::check(ptr, fmt_len) == false ||
+                extend(_sites, id) == false)
+            {
+                return false;
+            }
+            _sites[id] = Site{line, (RecordKind)kind, file, std::string_view(ptr, fmt_len)};
+            return true;
+        }
+
+        bool readName(const char *ptr, const char *end, std::vector<std::string_view> &names)
+        {
+            uint64_t id;
+            if (!binary::getVarint(ptr, end, id) || extend(names, id) == false)
+            {
+                return false;
+            }
+            names[id] = std::string_view(ptr, end - ptr);
+            return true;
+        }
+
+        bool readThread(const char *ptr, const char *end)
+        {
+            uint64_t id;
+            if (!binary::getVarint(ptr, end, id) || (size_t)(end - ptr) != sizeof(std::thread::id) || extend(_threads, id) == false)
+            {
+                return false;
+            }
+            memcpy((void *)&_threads[id], ptr, sizeof(std::thread::id));
+            return true;
+        }
+
+        bool readLog(const char *ptr, const char *end, Entry &entry)
+        {
+            uint64_t delta, thread, logger, site;
+            if (!binary::getVarint(ptr, end, delta) || ptr >= end)
+            {
+                return false;
+            }
+            uint8_t level = (uint8_t)*ptr++;
+            if (!binary::getVarint(ptr, end, thread) || !binary::getVarint(ptr, end, logger) || !binary::getVarint(ptr, end, site) ||
+                thread >= _threads.size() || logger >= _loggers.size() || site >= _sites.size())
+            {
+                return false;
+            }
+            _last_stamp += (uint64_t)binary::unzigzag(delta);
+            const Site &s = _sites[site];
+            entry._stamp = _last_stamp;
+            entry._level = (LogLevel::value)level;
+            entry._line = s._line;
+            entry._tid = _threads[thread];
+            entry._file = s._file;
+            entry._logger = _loggers[logger];
+            if (s._kind == RecordKind::TEXT)
+            {
+                uint64_t len;
+                if (!binary::getVarint(ptr, end, len) || len > (uint64_t)(end - ptr))
+                {
+                    return false;
+                }
+                entry._payload = std::string_view(ptr, len);
+                entry._fields = std::string_view(ptr + len, end - ptr - len);
+                return true;
+            }
+            _payload.reset();
+            binary::ArgDecoder args(ptr, end);
+            Record::render(_payload, s._fmt.data(), s._fmt.size(), args);
+            entry._payload = std::string_view(_payload.begin(), _payload.readAbleSize());
+            entry._fields = std::string_view(args.position(), end - args.position());
+            return args.bad() == false;
+        }
+
+    private:
+        const char *_ptr;
+        const char *_end;
+        uint64_t _last_stamp;
+        bool _bad;
+        std::vector<Site> _sites;
+        std::vector<std::string_view> _loggers;
+        std::vector<std::thread::id> _threads;
+        Buffer _payload; // 还原日志消息使用的缓冲区
+    };
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef __M_FMT_H__
+#define __M_FMT_H__
+
+/*  花括号风格的日志消息组织: "room {} created by {}"
+    1. 格式化字符串通过TJQ_FMT包装成类型, 编译期检查格式是否正确以及占位符数量与参数数量是否一致
+    2. 参数按类型直接写入调用方提供的缓冲区, 不经过vsnprintf, 不构造std::string, 不申请内存
+    3. "{{"与"}}"分别输出"{"与"}", 占位符只支持"{}"
+    4. 参数列表末尾可以附加tjq::kv创建的结构化字段, 不参与消息字符串的组织, 单独编码为字段块(见Fields.hpp)
+*/
+
+#include <string>
+#include <cstdint>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+#include "Buffer.hpp"
+#include "Format.hpp"
+#include "Fields.hpp"
+
+namespace tjq
+{
+    namespace format
+    {
+        // TJQ_FMT生成的类型都派生自该类型, 通过静态成员函数value()取得格式化字符串
+        struct FmtTag
+        {
+        };
+
+        // 编译期统计占位符数量, 格式错误返回-1
+        constexpr int placeholders(std::string_view fmt)
+        {
+            int count = 0;
+            for (size_t pos = 0; pos < fmt.size(); pos++)
+            {
+                if (fmt[pos] == '{')
+                {
+                    if (pos + 1 >= fmt.size())
+                        return -1;
+                    if (fmt[pos + 1] == '}')
+                        count++;
+                    else if (fmt[pos + 1] != '{')
+                        return -1;
+                    pos++;
+                }
+                else if (fmt[pos] == '}')
+                {
+                    if (pos + 1 >= fmt.size() || fmt[pos + 1] != '}')
+                        return -1;
+                    pos++;
+                }
+            }
+            return count;
+        }
+
+        // 按类型将单个参数写入缓冲区
+        template <typename T>
+        inline void value(Buffer &out, const T &val)
+        {
+            using Type = std::decay_t<T>;
+            if constexpr (std::is_same<Type, bool>::value)
+            {
+                append(out, val ? std::string_view("true") : std::string_view("false"));
+            }
+            else if constexpr (std::is_same<Type, char>::value)
+            {
+                out.push(&val, 1);
+            }
+            else if constexpr (std::is_integral<Type>::value)
+            {
+                append(out, val);
+            }
+            else if constexpr (std::is_floating_point<Type>::value)
+            {
+                char *ptr = out.reserve(64);
+                auto res = std::to_chars(ptr, ptr + 64, val);
+                out.moveWriter(res.ptr - ptr);
+            }
+            else if constexpr (std::is_array<T>::value)
+            {
+                append(out, std::string_view(val));
+            }
+            else if constexpr (std::is_same<Type, const char *>::value || std::is_same<Type, char *>::value)
+            {
+                append(out, val == nullptr ? std::string_view("(null)") : std::string_view(val));
+            }
+            else if constexpr (std::is_convertible<const T &, std::string_view>::value)
+            {
+                append(out, std::string_view(val));
+            }
+            else if constexpr (std::is_pointer<Type>::value || std::is_null_pointer<Type>::value)
+            {
+                char *ptr = out.reserve(24);
+                ptr[0] = '0', ptr[1] = 'x';
+                auto res = std::to_chars(ptr + 2, ptr + 24, (uintptr_t)(const void *)val, 16);
+                out.moveWriter(res.ptr - ptr);
+            }
+            else
+            {
+                stream(out, val); // 其余类型通过operator<<输出
+            }
+        }
+
+        // 输出[pos, 下一个占位符)之间的文本, 处理"{{"与"}}", 返回占位符之后的位置(没有占位符则返回fmt.size())
+        inline size_t text(Buffer &out, std::string_view fmt, size_t pos)
+        {
+            size_t start = pos;
+            while (pos < fmt.size())
+            {
+                char c = fmt[pos];
+                if (c != '{' && c != '}')
+                {
+                    pos++;
+                    continue;
+                }
+                out.push(fmt.data() + start, pos - start);
+                if (c == '{' && pos + 1 < fmt.size() && fmt[pos + 1] == '}')
+                {
+                    return pos + 2;
+                }
+                out.push(&c, 1); // "{{" 或 "}}"
+                pos += 2;
+                start = pos;
+            }
+            out.push(fmt.data() + start, fmt.size() - start);
+            return fmt.size();
+        }
+
+        // 按照格式化字符串将参数依次写入缓冲区, 结构化字段跳过
+        inline void print(Buffer &out, std::string_view fmt)
+        {
+            text(out, fmt, 0);
+        }
+        template <typename T, typename... Args>
+        inline void print(Buffer &out, std::string_view fmt, const Field<T> &, const Args &...rest)
+        {
+            print(out, fmt, rest...);
+        }
+        template <typename T, typename... Args>
+        inline void print(Buffer &out, std::string_view fmt, const T &first, const Args &...rest)
+        {
+            size_t pos = text(out, fmt, 0);
+            value(out, first);
+            print(out, fmt.substr(pos), rest...);
+        }
+
+        // 占位符参数(结构化字段之外的参数)的数量
+        template <typename... Args>
+        constexpr int positional()
+        {
+            return (0 + ... + (IsField<Args>::value ? 0 : 1));
+        }
+
+        // 结构化字段是否都在占位符参数之后
+        template <typename... Args>
+        constexpr bool fieldsLast()
+        {
+            bool field = false, ok = true;
+            ((ok = ok && (field == false || IsField<Args>::value), field = field || IsField<Args>::value), ...);
+            return ok;
+        }
+
+        // 按类型将单个字段编码到字段块; 其余类型先通过operator<<转换为字符串
+        template <typename T>
+        inline void field(Buffer &out, const Field<T> &f)
+        {
+            using Type = std::decay_t<T>;
+            if constexpr (std::is_same<Type, bool>::value)
+                fields::putBool(out, f._key, f._value);
+            else if constexpr (std::is_same<Type, char>::value)
+                fields::putString(out, f._key, std::string_view(&f._value, 1));
+            else if constexpr (std::is_integral<Type>::value && std::is_signed<Type>::value)
+                fields::putInt(out, f._key, f._value);
+            else if constexpr (std::is_integral<Type>::value)
+                fields::putUint(out, f._key, f._value);
+            else if constexpr (std::is_floating_point<Type>::value)
+                fields::putDouble(out, f._key, (double)f._value);
+            else if constexpr (std::is_array<T>::value)
+                fields::putString(out, f._key, std::string_view(f._value));
+            else if constexpr (std::is_same<Type, const char *>::value || std::is_same<Type, char *>::value)
+                fields::putString(out, f._key, f._value == nullptr ? std::string_view("(null)") : std::string_view(f._value));
+            else if constexpr (std::is_convertible<const T &, std::string_view>::value)
+                fields::putString(out, f._key, std::string_view(f._value));
+            else
+            {
+                static thread_local Buffer str(FORMAT_BUFFER_SIZE);
+                str.reset();
+                value(str, f._value);
+                fields::putString(out, f._key, std::string_view(str.begin(), str.readAbleSize()));
+            }
+        }
+
+        // 将参数列表中的结构化字段依次编码到字段块
+        template <typename... Args>
+        inline void encodeFields(Buffer &out, const Args &...args)
+        {
+            auto encode = [&out](const auto &arg)
+            {
+                if constexpr (IsField<std::decay_t<decltype(arg)>>::value)
+                {
+                    field(out, arg);
+                }
+            };
+            (encode(args), ...);
+        }
+    }
+}
+
+// 将字符串字面量包装为类型, 使格式化字符串可以在编译期检查
+#define TJQ_FMT(s)                                               \
+    [] {                                                         \
+        struct tjq_fmt_ : tjq::format::FmtTag                    \
+        {                                                        \
+            static constexpr std::string_view value()            \
+            {                                                    \
+                return s;                                        \
+            }                                                    \
+        };                                                       \
+        return tjq_fmt_{};                                       \
+    }()
+
+#endif
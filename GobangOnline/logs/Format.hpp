@@ -1,37 +1,281 @@
 #ifndef __M_FORMAT_H__
 #define __M_FORMAT_H__
 
+#include <array>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <sstream>
+#include <utility>
+#include <charconv>
+#include <string_view>
 #include "Message.hpp"
+#include "Buffer.hpp"
+#include "Fields.hpp"
+
+#define FORMAT_BUFFER_SIZE (4 * 1024) // 格式化使用的线程局部缓冲区的初始大小
+#define JSON_TIME_FORMAT "%Y-%m-%dT%H:%M:%S.%6f" // %J未指定子格式时使用的时间格式
 
 namespace tjq
 {
+    namespace format
+    {
+        // 向缓冲区写入字符串
+        inline void append(Buffer &out, std::string_view str)
+        {
+            out.push(str.data(), str.size());
+        }
+
+        // 向缓冲区写入整数(不经过流, 不申请内存)
+        template <typename T>
+        inline void append(Buffer &out, T val, typename std::enable_if<std::is_integral<T>::value>::type * = nullptr)
+        {
+            char *ptr = out.reserve(24);
+            auto res = std::to_chars(ptr, ptr + 24, val);
+            out.moveWriter(res.ptr - ptr);
+        }
+
+        // 以Buffer作为输出目标的流缓冲区, 用于只能通过operator<<输出的类型(如线程ID)
+        class BufferStreamBuf : public std::streambuf
+        {
+        public:
+            void attach(Buffer *out)
+            {
+                _out = out;
+            }
+
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                if (traits_type::eq_int_type(ch, traits_type::eof()) == false)
+                {
+                    char c = traits_type::to_char_type(ch);
+                    _out->push(&c, 1);
+                }
+                return ch;
+            }
+            std::streamsize xsputn(const char *s, std::streamsize n) override
+            {
+                _out->push(s, n);
+                return n;
+            }
+
+        private:
+            Buffer *_out = nullptr;
+        };
+
+        // 通过线程局部的输出流向缓冲区写入对象, 流对象只构造一次
+        template <typename T>
+        inline void stream(Buffer &out, const T &val)
+        {
+            struct LocalStream
+            {
+                BufferStreamBuf _buf;
+                std::ostream _os;
+                LocalStream()
+                    : _os(&_buf)
+                {
+                }
+            };
+            static thread_local LocalStream local;
+            local._buf.attach(&out);
+            local._os << val;
+        }
+
+        // 格式化过程使用的线程局部缓冲区, 稳定运行后不再申请内存
+        inline Buffer &localBuffer()
+        {
+            static thread_local Buffer buf(FORMAT_BUFFER_SIZE);
+            buf.reset();
+            return buf;
+        }
+    }
+
+    /*  时间格式化: 子格式在strftime的基础上, 额外支持 %3f(毫秒) %6f(微秒) %9f(纳秒)
+        (不使用%ms这类写法: strftime中%m后面紧跟普通字符s是合法的子格式)
+        1. 构造时将子格式切分为 [strftime片段 + 亚秒字段] 序列
+        2. 每个线程缓存当前秒渲染好的时间字符串, 同一秒内只需要填充亚秒数字, 不再调用localtime_r/strftime
+    */
+    class TimeRender
+    {
+    public:
+        TimeRender(const std::string &fmt)
+            : _id(nextId())
+        {
+            std::string text;
+            size_t pos = 0;
+            while (pos < fmt.size())
+            {
+                if (fmt[pos] == '%' && pos + 1 < fmt.size() && fmt[pos + 1] == '%')
+                {
+                    text.append("%%");
+                    pos += 2;
+                    continue;
+                }
+                int digits = 0;
+                if (fmt[pos] == '%' && pos + 2 < fmt.size() && fmt[pos + 2] == 'f')
+                {
+                    digits = fmt[pos + 1] == '3' ? 3 : fmt[pos + 1] == '6' ? 6 : fmt[pos + 1] == '9' ? 9 : 0;
+                }
+                if (digits == 0)
+                {
+                    text.push_back(fmt[pos++]);
+                    continue;
+                }
+                _segments.push_back(Segment{text, digits});
+                text.clear();
+                pos += 3;
+            }
+            _segments.push_back(Segment{text, 0});
+        }
+
+        void format(Buffer &out, uint64_t stamp)
+        {
+            time_t sec = (time_t)(stamp / 1000000000);
+            uint32_t nsec = (uint32_t)(stamp % 1000000000);
+            // 1. 查找线程局部缓存, 不是当前秒则重新渲染
+            Entry &entry = cache()[_id % CACHE_SIZE];
+            if (entry._id != _id || entry._sec != sec)
+            {
+                render(entry, sec);
+            }
+            // 2. 拷贝缓存的字符串, 填充亚秒数字
+            char *ptr = out.reserve(entry._len);
+            memcpy(ptr, entry._text, entry._len);
+            for (size_t i = 0; i < entry._nfrac; i++)
+            {
+                uint32_t val = nsec;
+                for (int d = entry._fracs[i]._digits; d < 9; d++)
+                {
+                    val /= 10;
+                }
+                for (int d = entry._fracs[i]._digits - 1; d >= 0; d--)
+                {
+                    ptr[entry._fracs[i]._offset + d] = '0' + val % 10;
+                    val /= 10;
+                }
+            }
+            out.moveWriter(entry._len);
+        }
+
+    private:
+        enum
+        {
+            CACHE_SIZE = 8, // 每个线程缓存的时间格式数量
+            TEXT_SIZE = 64, // 渲染后时间字符串的最大长度
+            MAX_FRACS = 4   // 单个子格式中亚秒字段的最大数量
+        };
+        struct Segment
+        {
+            std::string _text; // strftime片段
+            int _digits;       // 片段之后的亚秒字段位数(0表示没有)
+        };
+        struct Entry
+        {
+            size_t _id = 0; // 缓存所属的时间格式化对象
+            time_t _sec = 0;
+            size_t _len = 0;
+            char _text[TEXT_SIZE];
+            size_t _nfrac = 0;
+            struct
+            {
+                size_t _offset;
+                int _digits;
+            } _fracs[MAX_FRACS];
+        };
+
+        static size_t nextId()
+        {
+            static std::atomic<size_t> id(0);
+            return ++id;
+        }
+
+        static Entry *cache()
+        {
+            static thread_local Entry entries[CACHE_SIZE];
+            return entries;
+        }
+
+        // 渲染指定秒的时间字符串, 亚秒字段先以'0'占位, 并记录其位置
+        void render(Entry &entry, time_t sec)
+        {
+            struct tm t;
+            localtime_r(&sec, &t);
+            entry._id = _id;
+            entry._sec = sec;
+            entry._len = 0;
+            entry._nfrac = 0;
+            for (auto &seg : _segments)
+            {
+                if (seg._text.empty() == false)
+                {
+                    entry._len += strftime(entry._text + entry._len, TEXT_SIZE - entry._len, seg._text.c_str(), &t);
+                }
+                if (seg._digits > 0 && entry._nfrac < MAX_FRACS && entry._len + seg._digits <= TEXT_SIZE)
+                {
+                    entry._fracs[entry._nfrac++] = {entry._len, seg._digits};
+                    memset(entry._text + entry._len, '0', seg._digits);
+                    entry._len += seg._digits;
+                }
+            }
+        }
+
+    private:
+        size_t _id; // 对象编号, 作为线程局部缓存的键(对象地址可能被复用, 编号不会)
+        std::vector<Segment> _segments;
+    };
+
+    // 将日志消息渲染为一个JSON对象(不含换行): 固定成员之后依次是结构化字段
+    // {"time":"...","level":"INFO","logger":"...","file":"...","line":12,"tid":"...","msg":"...","room_id":1001}
+    inline void renderJson(Buffer &out, const LogMessage &msg, TimeRender &render)
+    {
+        format::append(out, "{\"time\":\"");
+        render.format(out, msg._stamp);
+        format::append(out, "\",\"level\":\"");
+        format::append(out, LogLevel::toString(msg._level));
+        format::append(out, "\",\"logger\":");
+        json::string(out, msg._logger);
+        format::append(out, ",\"file\":");
+        json::string(out, msg._file);
+        format::append(out, ",\"line\":");
+        format::append(out, msg._line);
+        format::append(out, ",\"tid\":\"");
+        format::stream(out, msg._tid);
+        format::append(out, "\",\"msg\":");
+        json::string(out, msg._payload);
+        fields::json(out, msg._fields);
+        format::append(out, "}");
+    }
+
     // 抽象格式化子项基类
     class FormatItem
     {
     public:
         using ptr = std::shared_ptr<FormatItem>;
-        virtual void format(std::ostream &out, const LogMessage &msg) = 0;
+        virtual ~FormatItem()
+        {
+        }
+        virtual void format(Buffer &out, const LogMessage &msg) = 0;
     };
 
     // 派生格式化子项子类: 消息, 等级, 时间, 文件名, 行号, 线程ID, 日志器名, 制表符, 换行, 其它
     class MessageFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << msg._payload;
+            format::append(out, msg._payload);
         }
     };
 
     class LevelFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << LogLevel::toString(msg._level);
+            format::append(out, LogLevel::toString(msg._level));
         }
     };
 
@@ -39,76 +283,99 @@ namespace tjq
     {
     public:
         TimeFormatItem(const std::string &fmt = "%H:%M:%S")
-            : _time_fmt(fmt)
+            : _time_fmt(fmt),
+              _render(fmt)
         {
         }
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            struct tm t;
-            localtime_r(&msg._ctime, &t);
-            char tmp[32] = {0};
-            strftime(tmp, 31, _time_fmt.c_str(), &t);
-            out << tmp;
+            _render.format(out, msg._stamp);
         }
 
     private:
-        std::string _time_fmt; //%H:%M:%S
+        std::string _time_fmt; //%H:%M:%S.%6f
+        TimeRender _render;
     };
 
     class FileFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << msg._file;
+            format::append(out, msg._file);
         }
     };
 
     class LineNumFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << msg._line;
+            format::append(out, msg._line);
         }
     };
 
     class ThreadFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << msg._tid;
+            format::stream(out, msg._tid);
         }
     };
 
     class LoggerFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << msg._logger;
+            format::append(out, msg._logger);
         }
     };
 
     class TabFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << "\t";
+            format::append(out, "\t");
         }
     };
 
     class LineFeedFormatItem : public FormatItem
     {
     public:
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
+        {
+            format::append(out, "\n");
+        }
+    };
+
+    class FieldsFormatItem : public FormatItem
+    {
+    public:
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << "\n";
+            fields::logfmt(out, msg._fields);
         }
     };
 
+    class JsonFormatItem : public FormatItem
+    {
+    public:
+        JsonFormatItem(const std::string &fmt)
+            : _render(fmt.empty() ? JSON_TIME_FORMAT : fmt)
+        {
+        }
+        void format(Buffer &out, const LogMessage &msg) override
+        {
+            renderJson(out, msg, _render);
+        }
+
+    private:
+        TimeRender _render;
+    };
+
     class OtherFormatItem : public FormatItem
     {
     public:
@@ -116,16 +383,16 @@ namespace tjq
             : _str(str)
         {
         }
-        void format(std::ostream &out, const LogMessage &msg) override
+        void format(Buffer &out, const LogMessage &msg) override
         {
-            out << _str;
+            format::append(out, _str);
         }
 
     private:
         std::string _str;
     };
 
-    /*  %d 表示日期, 包含子格式{%H:%M:%S}
+    /*  %d 表示日期, 包含子格式{%H:%M:%S}, 子格式额外支持%3f/%6f/%9f(毫秒/微秒/纳秒), 如{%H:%M:%S.%6f}
         %t 表示线程ID
         %c 表示日志器名称
         %f 表示源码文件名
@@ -134,6 +401,8 @@ namespace tjq
         %T 表示制表符缩进
         %m 表示主体消息
         %n 表示换行
+        %k 表示结构化字段(logfmt, 每个字段之前有一个空格: " room_id=1001 uid=42")
+        %J 表示整条日志的JSON对象, 包含子格式{时间格式}, 默认为{%Y-%m-%dT%H:%M:%S.%6f}, JSON行使用"%J%n"
     */
 
     class Formatter
@@ -143,22 +412,43 @@ namespace tjq
         Formatter(const std::string &pattern = "[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n")
             : _pattern(pattern)
         {
-            assert(parsePattern());
+            bool ret = parsePattern();
+            assert(ret);
+            (void)ret;
+        }
+        virtual ~Formatter()
+        {
         }
 
-        // 对msg进行格式化
-        void format(std::ostream &out, const LogMessage &msg)
+        // 对msg进行格式化, 直接写入缓冲区
+        virtual void format(Buffer &out, const LogMessage &msg)
         {
             for (auto &item : _items)
             {
                 item->format(out, msg);
             }
         }
+        void format(std::ostream &out, const LogMessage &msg)
+        {
+            Buffer &buf = format::localBuffer();
+            format(buf, msg);
+            out.write(buf.begin(), buf.readAbleSize());
+        }
         std::string format(const LogMessage &msg)
         {
-            std::stringstream ss;
-            format(ss, msg);
-            return ss.str();
+            Buffer &buf = format::localBuffer();
+            format(buf, msg);
+            return std::string(buf.begin(), buf.readAbleSize());
+        }
+
+    protected:
+        // 供编译期格式化器使用: 格式化规则已经在编译期解析完毕, 不需要再进行运行时解析
+        struct Parsed
+        {
+        };
+        Formatter(Parsed, const std::string &pattern)
+            : _pattern(pattern)
+        {
         }
 
     private:
@@ -220,6 +510,11 @@ namespace tjq
                 key.clear();
                 val.clear();
             }
+            // 6) 提交末尾剩余的原始字符串
+            if (val.empty() == false)
+            {
+                fmt_order.push_back(std::make_pair("", val));
+            }
 
             // 2. 根据解析得到的数据初始化格式化子项数组成员
             for (auto &it : fmt_order)
@@ -250,6 +545,10 @@ namespace tjq
                 return std::make_shared<MessageFormatItem>();
             if (key == "n")
                 return std::make_shared<LineFeedFormatItem>();
+            if (key == "k")
+                return std::make_shared<FieldsFormatItem>();
+            if (key == "J")
+                return std::make_shared<JsonFormatItem>(val);
             if (key == "")
                 return std::make_shared<OtherFormatItem>(val);
 
@@ -262,6 +561,251 @@ namespace tjq
         std::string _pattern; // 格式化规则字符串
         std::vector<FormatItem::ptr> _items;
     };
+
+    /*  编译期格式化器: 在编译期对格式化规则字符串进行解析, 规则错误则编译失败
+        1. 格式化规则必须是具有静态存储期的字符数组常量, 例如:
+           static constexpr char pattern[] = "[%d{%H:%M:%S}][%t][%c][%f:%l][%p]%T%m%n";
+           tjq::StaticFormatter<pattern> fmt;
+        2. 解析得到固定的格式化子项序列, 每个子项在编译期确定处理方式, 没有虚函数调用
+        3. 运行时的Formatter依然保留, 用于处理从配置中加载的格式化规则
+    */
+    namespace pattern
+    {
+        enum class Kind
+        {
+            INVALID,
+            TIME,
+            THREAD,
+            LOGGER,
+            FILE,
+            LINE,
+            LEVEL,
+            TAB,
+            MESSAGE,
+            LINEFEED,
+            FIELDS,
+            JSON,
+            OTHER
+        };
+
+        enum class Error
+        {
+            NONE,
+            NO_KEY,    // '%'之后没有对应的格式化字符
+            NO_BRACE,  // 子规则"{}"匹配出错
+            BAD_KEY    // 没有对应的格式化字符
+        };
+
+        // 格式化子项: 原始字符串/子规则在格式化规则字符串中的范围为[_begin, _begin + _len)
+        struct Item
+        {
+            Kind _kind = Kind::INVALID;
+            size_t _begin = 0;
+            size_t _len = 0;
+        };
+
+        constexpr Kind kindOf(char key)
+        {
+            switch (key)
+            {
+            case 'd':
+                return Kind::TIME;
+            case 't':
+                return Kind::THREAD;
+            case 'c':
+                return Kind::LOGGER;
+            case 'f':
+                return Kind::FILE;
+            case 'l':
+                return Kind::LINE;
+            case 'p':
+                return Kind::LEVEL;
+            case 'T':
+                return Kind::TAB;
+            case 'm':
+                return Kind::MESSAGE;
+            case 'n':
+                return Kind::LINEFEED;
+            case 'k':
+                return Kind::FIELDS;
+            case 'J':
+                return Kind::JSON;
+            }
+            return Kind::INVALID;
+        }
+
+        // 与Formatter::parsePattern规则一致的编译期解析, items为空时只统计子项数量
+        constexpr Error parse(std::string_view pattern, Item *items, size_t &count)
+        {
+            count = 0;
+            size_t pos = 0, raw = std::string_view::npos;
+            auto emit = [&](Kind kind, size_t begin, size_t len)
+            {
+                if (items != nullptr)
+                {
+                    items[count] = Item{kind, begin, len};
+                }
+                count++;
+            };
+            while (pos < pattern.size())
+            {
+                // 1) 原始字符
+                if (pattern[pos] != '%')
+                {
+                    raw = raw == std::string_view::npos ? pos : raw;
+                    pos += 1;
+                    continue;
+                }
+                // 2) "%%"处理成为一个原始'%'字符: 原始字符串截止到第一个'%'
+                if (pos + 1 < pattern.size() && pattern[pos + 1] == '%')
+                {
+                    raw = raw == std::string_view::npos ? pos : raw;
+                    emit(Kind::OTHER, raw, pos + 1 - raw);
+                    raw = std::string_view::npos;
+                    pos += 2;
+                    continue;
+                }
+                // 3) 提交前面的原始字符串
+                if (raw != std::string_view::npos)
+                {
+                    emit(Kind::OTHER, raw, pos - raw);
+                    raw = std::string_view::npos;
+                }
+                // 4) 处理格式化字符
+                pos += 1;
+                if (pos == pattern.size())
+                {
+                    return Error::NO_KEY;
+                }
+                Kind kind = kindOf(pattern[pos]);
+                if (kind == Kind::INVALID)
+                {
+                    return Error::BAD_KEY;
+                }
+                pos += 1;
+                // 5) 处理"{子规则}"
+                size_t begin = pos, len = 0;
+                if (pos < pattern.size() && pattern[pos] == '{')
+                {
+                    begin = ++pos;
+                    while (pos < pattern.size() && pattern[pos] != '}')
+                    {
+                        pos += 1;
+                    }
+                    if (pos == pattern.size())
+                    {
+                        return Error::NO_BRACE;
+                    }
+                    len = pos - begin;
+                    pos += 1;
+                }
+                emit(kind, begin, len);
+            }
+            if (raw != std::string_view::npos)
+            {
+                emit(Kind::OTHER, raw, pattern.size() - raw);
+            }
+            return Error::NONE;
+        }
+
+        constexpr Error check(std::string_view pattern)
+        {
+            size_t count = 0;
+            return parse(pattern, nullptr, count);
+        }
+
+        constexpr size_t count(std::string_view pattern)
+        {
+            size_t count = 0;
+            parse(pattern, nullptr, count);
+            return count;
+        }
+
+        template <size_t N>
+        constexpr std::array<Item, N> items(std::string_view pattern)
+        {
+            std::array<Item, N> items{};
+            size_t count = 0;
+            parse(pattern, items.data(), count);
+            return items;
+        }
+
+        template <const char *Pattern>
+        struct Traits
+        {
+            static constexpr std::string_view str = Pattern;
+            static constexpr Error error = check(str);
+            static_assert(error != Error::NO_KEY, "格式化规则错误: '%'之后没有对应的格式化字符!");
+            static_assert(error != Error::NO_BRACE, "格式化规则错误: 子规则\"{}\"匹配出错!");
+            static_assert(error != Error::BAD_KEY, "格式化规则错误: 没有对应的格式化字符!");
+            static constexpr size_t size = count(str);
+            static constexpr std::array<Item, size> list = items<size>(str);
+        };
+
+        // 第I个格式化子项, 处理方式在编译期确定
+        template <const char *Pattern, size_t I>
+        struct StaticItem
+        {
+            static constexpr Item item = Traits<Pattern>::list[I];
+            static constexpr std::string_view text = Traits<Pattern>::str.substr(item._begin, item._len);
+
+            static void format(Buffer &out, const LogMessage &msg)
+            {
+                if constexpr (item._kind == Kind::TIME)
+                {
+                    static TimeRender render{std::string(text)};
+                    render.format(out, msg._stamp);
+                }
+                else if constexpr (item._kind == Kind::THREAD)
+                    format::stream(out, msg._tid);
+                else if constexpr (item._kind == Kind::LOGGER)
+                    format::append(out, msg._logger);
+                else if constexpr (item._kind == Kind::FILE)
+                    format::append(out, msg._file);
+                else if constexpr (item._kind == Kind::LINE)
+                    format::append(out, msg._line);
+                else if constexpr (item._kind == Kind::LEVEL)
+                    format::append(out, LogLevel::toString(msg._level));
+                else if constexpr (item._kind == Kind::TAB)
+                    format::append(out, "\t");
+                else if constexpr (item._kind == Kind::MESSAGE)
+                    format::append(out, msg._payload);
+                else if constexpr (item._kind == Kind::LINEFEED)
+                    format::append(out, "\n");
+                else if constexpr (item._kind == Kind::FIELDS)
+                    fields::logfmt(out, msg._fields);
+                else if constexpr (item._kind == Kind::JSON)
+                {
+                    static TimeRender render{text.empty() ? std::string(JSON_TIME_FORMAT) : std::string(text)};
+                    renderJson(out, msg, render);
+                }
+                else
+                    format::append(out, text);
+            }
+        };
+
+        template <const char *Pattern, size_t... I>
+        void formatAll(Buffer &out, const LogMessage &msg, std::index_sequence<I...>)
+        {
+            (StaticItem<Pattern, I>::format(out, msg), ...);
+        }
+    }
+
+    template <const char *Pattern>
+    class StaticFormatter : public Formatter
+    {
+    public:
+        StaticFormatter()
+            : Formatter(Parsed(), Pattern)
+        {
+        }
+
+        void format(Buffer &out, const LogMessage &msg) override
+        {
+            pattern::formatAll<Pattern>(out, msg, std::make_index_sequence<pattern::Traits<Pattern>::size>());
+        }
+        using Formatter::format;
+    };
 }
 
 #endif
\ No newline at end of file
@@ -8,12 +8,26 @@
 
 #include <mutex>
 #include <atomic>
+#include <thread>
 #include <cstdarg>
+#include <fstream>
+#include <algorithm>
+#include <functional>
 #include <unordered_map>
 #include "Level.hpp"
 #include "Format.hpp"
+#include "Fmt.hpp"
+#include "Site.hpp"
 #include "Sink.hpp"
 #include "Looper.hpp"
+#include "Record.hpp"
+#include "Recorder.hpp"
+#include "Stats.hpp"
+#include "Limiter.hpp"
+
+#define DROP_REPORT_INTERVAL 1 // 异步日志器输出丢弃提示的最小间隔(秒)
+#define COALESCE_INTERVAL 1    // 重复合并: 连续重复持续超过该时间(秒)时, 在一批日志写完后先输出一次重复提示
+#define FORMATTER_CACHE_SIZE 8 // 每个线程缓存的日志器格式化器数量
 
 namespace tjq
 {
@@ -24,9 +38,24 @@ namespace tjq
         Logger(const std::string &logger_name, LogLevel::value level, Formatter::ptr &formatter, std::vector<LogSink::ptr> &sinks)
             : _logger_name(logger_name),
               _limit_level(level),
-              _formatter(formatter),
-              _sinks(sinks.begin(), sinks.end())
+              _id(nextId()),
+              _formatter(formatter)
         {
+            // 需要原始日志记录的落地方向单独管理
+            for (auto &sink : sinks)
+            {
+                if (sink->needRecord())
+                    _record_sinks.push_back(sink);
+                else
+                    _sinks.push_back(sink);
+            }
+            _list.store(new SinkList(_sinks, _record_sinks), std::memory_order_release);
+            _text_output = _sinks.empty() == false;
+            _record_output = _record_sinks.empty() == false;
+        }
+        virtual ~Logger()
+        {
+            delete _list.load(std::memory_order_relaxed);
         }
 
         const std::string &name()
@@ -34,127 +63,529 @@ namespace tjq
             return _logger_name;
         }
 
+        /*  运行时重新配置: 输出等级、格式化器、落地方向都可以在运行期间修改(例如由监视配置文件的后台线程调用)
+            1. 生产者路径上不增加任何加锁: 等级通过原子变量读取; 格式化器由每个线程缓存, 只在版本号变化后重新获取
+            2. 落地方向列表以不可变快照(SinkList)发布: 重新配置构造新的快照后原子地替换指针, 写入方在落地锁内以acquire读取, 不增加其他加锁
+            3. 替换之后重新配置的一方获取一次落地锁再释放旧快照, 因此只会等待一次正在进行的写入(异步日志器为工作线程正在处理的一批)
+            4. 多个重新配置的操作之间通过_config_mutex互斥
+        */
+        void setLevel(LogLevel::value level)
+        {
+            _limit_level.store(level, std::memory_order_relaxed);
+        }
+        LogLevel::value level()
+        {
+            return _limit_level.load(std::memory_order_relaxed);
+        }
+
+        // 替换格式化器, 对之后格式化的日志生效; 旧的格式化器在各线程的缓存都换用新对象后释放
+        void setFormatter(const Formatter::ptr &formatter)
+        {
+            if (formatter.get() == nullptr)
+            {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(_config_mutex);
+            std::atomic_store_explicit(&_formatter, formatter, std::memory_order_release);
+            _formatter_version.fetch_add(1, std::memory_order_release);
+        }
+
+        // 添加落地方向; 已经添加过或当前日志器无法支持(见各日志器的attach)时返回false
+        bool addSink(const LogSink::ptr &sink)
+        {
+            if (sink.get() == nullptr)
+            {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_config_mutex);
+            std::vector<LogSink::ptr> &list = sink->needRecord() ? _record_sinks : _sinks;
+            if (std::find(list.begin(), list.end(), sink) != list.end() || attach(sink) == false)
+            {
+                return false;
+            }
+            list.push_back(sink);
+            refresh();
+            return true;
+        }
+
+        /*  移除落地方向, 不存在时返回false
+            返回时已经没有写入正在使用该落地方向, 之后的写入也不会再交给它(包括异步日志器缓冲区中尚未落地的日志)
+            会等待正在进行的一次写入完成, 不能在落地方向的写入过程中调用
+        */
+        bool removeSink(const LogSink::ptr &sink)
+        {
+            if (sink.get() == nullptr)
+            {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(_config_mutex);
+            bool record = sink->needRecord();
+            std::vector<LogSink::ptr> &list = record ? _record_sinks : _sinks;
+            auto it = std::find(list.begin(), list.end(), sink);
+            if (it == list.end())
+            {
+                return false;
+            }
+            detach(record, it - list.begin());
+            list.erase(it);
+            refresh();
+            return true;
+        }
+
+        // 当前的所有落地方向(文本落地方向在前)
+        std::vector<LogSink::ptr> sinks()
+        {
+            std::unique_lock<std::mutex> lock(_config_mutex);
+            std::vector<LogSink::ptr> result(_sinks);
+            result.insert(result.end(), _record_sinks.begin(), _record_sinks.end());
+            return result;
+        }
+
+        // 等待之前输出的日志全部落地, 并强制刷新落地方向的缓冲数据(FLUSH_FSYNC策略下同步到磁盘)
+        virtual void flush() = 0;
+
+        // 运行时统计快照
+        virtual LoggerStats stats()
+        {
+            LoggerStats st;
+            st._name = _logger_name;
+            st._sink_latency = _sink_latency.snapshot();
+            st._buffer_growths = Buffer::growths();
+            return st;
+        }
+
+        // 判断指定等级的日志是否需要输出(达到日志器的输出等级, 或者需要进入飞行记录器)
+        bool shouldLog(LogLevel::value level)
+        {
+            return level >= _limit_level.load(std::memory_order_relaxed) || FlightRecorder::wants(level);
+        }
+
         // 完成构造日志消息对象过程并进行格式化, 得到格式化后的日志消息字符串, 然后进行落地输出
-        void debug(const std::string &file, size_t line, const std::string &fmt, ...)
+        void debug(const CallSite &site, const std::string &fmt, ...)
         {
             // 通过传入的参数构造出一个日志消息对象, 进行日志的格式化, 最终落地
             // 1. 判断当前的日志是否达到了输出等级
-            if (LogLevel::value::DEBUG < _limit_level)
+            if (shouldLog(LogLevel::value::DEBUG) == false)
             {
                 return;
             }
-            // 2. 对fmt格式化字符和不定参进行字符串组织, 得到日志消息字符串
+            // 2. 对fmt格式化字符和不定参进行字符串组织, 得到日志消息字符串, 然后进行格式化与落地
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
-            {
-                std::cerr << "Logger.hpp::Logger::debug: vasprintf failed!" << std::endl;
-                return;
-            }
+            serialize(LogLevel::value::DEBUG, site, fmt, ap);
             va_end(ap);
-            serialize(LogLevel::value::DEBUG, file, line, res);
-            free(res);
         }
-        void info(const std::string &file, size_t line, const std::string &fmt, ...)
+        void info(const CallSite &site, const std::string &fmt, ...)
         {
-            if (LogLevel::value::INFO < _limit_level)
+            if (shouldLog(LogLevel::value::INFO) == false)
             {
                 return;
             }
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            serialize(LogLevel::value::INFO, site, fmt, ap);
+            va_end(ap);
+        }
+        void warn(const CallSite &site, const std::string &fmt, ...)
+        {
+            if (shouldLog(LogLevel::value::WARN) == false)
             {
-                std::cerr << "Logger.hpp::Logger::info: vasprintf failed!" << std::endl;
                 return;
             }
+            va_list ap;
+            va_start(ap, fmt);
+            serialize(LogLevel::value::WARN, site, fmt, ap);
             va_end(ap);
-            serialize(LogLevel::value::INFO, file, line, res);
-            free(res);
         }
-        void warn(const std::string &file, size_t line, const std::string &fmt, ...)
+        void error(const CallSite &site, const std::string &fmt, ...)
         {
-            if (LogLevel::value::WARN < _limit_level)
+            if (shouldLog(LogLevel::value::ERROR) == false)
             {
                 return;
             }
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            serialize(LogLevel::value::ERROR, site, fmt, ap);
+            va_end(ap);
+        }
+        void fatal(const CallSite &site, const std::string &fmt, ...)
+        {
+            if (shouldLog(LogLevel::value::FATAL) == false)
             {
-                std::cerr << "Logger.hpp::Logger::warn: vasprintf failed!" << std::endl;
                 return;
             }
+            va_list ap;
+            va_start(ap, fmt);
+            serialize(LogLevel::value::FATAL, site, fmt, ap);
             va_end(ap);
-            serialize(LogLevel::value::WARN, file, line, res);
-            free(res);
         }
-        void error(const std::string &file, size_t line, const std::string &fmt, ...)
+
+        /*  花括号风格的接口: 格式化字符串需要通过TJQ_FMT包装, 格式错误或参数数量不符则编译失败
+            logger->info(TJQ_FMT("room {} created by {}"), rid, uid);
+            通过Log.h中的LOG_INFO等宏调用时, 日志等级未达到则不会对参数求值
+            参数列表末尾可以附加结构化字段: LOG_INFO(logger, "room created", tjq::kv("room_id", rid), tjq::kv("uid", uid));
+        */
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void debug(const CallSite &site, S fmt, const Args &...args)
+        {
+            logFormat(LogLevel::value::DEBUG, site, fmt, args...);
+        }
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void info(const CallSite &site, S fmt, const Args &...args)
+        {
+            logFormat(LogLevel::value::INFO, site, fmt, args...);
+        }
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void warn(const CallSite &site, S fmt, const Args &...args)
+        {
+            logFormat(LogLevel::value::WARN, site, fmt, args...);
+        }
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void error(const CallSite &site, S fmt, const Args &...args)
+        {
+            logFormat(LogLevel::value::ERROR, site, fmt, args...);
+        }
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void fatal(const CallSite &site, S fmt, const Args &...args)
         {
-            if (LogLevel::value::ERROR < _limit_level)
+            logFormat(LogLevel::value::FATAL, site, fmt, args...);
+        }
+        template <typename S, typename... Args>
+        void logFormat(LogLevel::value level, const CallSite &site, S fmt, const Args &...args)
+        {
+            logSuppressed(level, site, 0, fmt, args...);
+        }
+
+        /*  采样/限流的调用点(Log.h中的LOG_INFO_EVERY_N, LOG_INFO_LIMITED等宏)使用的接口
+            suppressed为该调用点上一次输出之后被抑制的条数, 大于0时追加在日志消息末尾
+        */
+        void logSuppressed(LogLevel::value level, const CallSite &site, uint64_t suppressed, const std::string &fmt, ...)
+        {
+            if (shouldLog(level) == false)
             {
                 return;
             }
             va_list ap;
             va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            std::string_view payload;
+            if (suppressed == 0)
             {
-                std::cerr << "Logger.hpp::Logger::error: vasprintf failed!" << std::endl;
-                return;
+                serialize(level, site, fmt, ap);
+            }
+            else if (print(fmt, ap, payload))
+            {
+                payloadBuffer().moveWriter(payload.size()); // print只写入数据, 没有移动写位置
+                submit(level, site, suppressedSuffix(suppressed), std::string_view());
             }
             va_end(ap);
-            serialize(LogLevel::value::ERROR, file, line, res);
-            free(res);
         }
-        void fatal(const std::string &file, size_t line, const std::string &fmt, ...)
+        template <typename S, typename... Args, typename = std::enable_if_t<std::is_base_of<format::FmtTag, S>::value>>
+        void logSuppressed(LogLevel::value level, const CallSite &site, uint64_t suppressed, S, const Args &...args)
         {
-            if (LogLevel::value::FATAL < _limit_level)
+            static_assert(format::placeholders(S::value()) >= 0, "invalid format string, use {} as placeholder and {{ }} for braces");
+            static_assert(format::placeholders(S::value()) == format::positional<Args...>(), "number of {} placeholders does not match number of arguments");
+            static_assert(format::fieldsLast<Args...>(), "structured fields (tjq::kv) must follow all placeholder arguments");
+            if (shouldLog(level) == false)
             {
                 return;
             }
-            va_list ap;
-            va_start(ap, fmt);
-            char *res;
-            int ret = vasprintf(&res, fmt.c_str(), ap);
-            if (ret == -1)
+            // 参数直接写入线程局部缓冲区
+            Buffer &payload = payloadBuffer();
+            payload.reset();
+            format::print(payload, S::value(), args...);
+            std::string_view message(payload.begin(), payload.readAbleSize());
+            if (suppressed > 0)
             {
-                std::cerr << "Logger.hpp::Logger::fatal: vasprintf failed!" << std::endl;
-                return;
+                message = suppressedSuffix(suppressed);
             }
-            va_end(ap);
-            serialize(LogLevel::value::FATAL, file, line, res);
-            free(res);
+            // 结构化字段编码为字段块
+            std::string_view block;
+            if constexpr (format::positional<Args...>() != (int)sizeof...(Args))
+            {
+                Buffer &buf = fieldsBuffer();
+                buf.reset();
+                format::encodeFields(buf, args...);
+                block = fields::clip(std::string_view(buf.begin(), buf.readAbleSize()), FIELDS_MAX_SIZE);
+            }
+            submit(level, site, message, block);
         }
 
     protected:
-        void serialize(LogLevel::value level, const std::string &file, size_t line, char *str)
+        // 日志消息字符串与格式化结果都写入线程局部缓冲区, 稳定运行后整个过程不再申请内存
+        // 低于输出等级的日志(只进入飞行记录器)不交给落地方向
+        virtual void serialize(LogLevel::value level, const CallSite &site, const std::string &fmt, va_list ap)
+        {
+            bool output = level >= _limit_level.load(std::memory_order_relaxed);
+            // 1. 存在需要原始日志记录的落地方向时, 先编码出日志记录交给它们
+            if (output && _record_output.load(std::memory_order_relaxed))
+            {
+                Buffer &record = recordBuffer();
+                record.reset();
+                va_list cp;
+                va_copy(cp, ap);
+                Record::encode(record, level, site, fmt.c_str(), fmt.size(), cp);
+                va_end(cp);
+                logRecord(record.begin(), record.readAbleSize());
+            }
+            output = output && _text_output.load(std::memory_order_relaxed);
+            if (output == false && FlightRecorder::wants(level) == false)
+            {
+                return;
+            }
+            // 2. 对fmt格式化字符和不定参进行字符串组织
+            std::string_view payload;
+            if (print(fmt, ap, payload))
+            {
+                emit(level, site, payload, output);
+            }
+        }
+
+        // 日志消息已经组织好(花括号风格的接口), 进行格式化与落地; block为结构化字段块
+        virtual void submit(LogLevel::value level, const CallSite &site, std::string_view payload, std::string_view block)
+        {
+            bool output = level >= _limit_level.load(std::memory_order_relaxed);
+            if (output && _record_output.load(std::memory_order_relaxed))
+            {
+                Buffer &record = recordBuffer();
+                record.reset();
+                Record::encodeText(record, level, site, payload.data(), payload.size(), block);
+                logRecord(record.begin(), record.readAbleSize());
+            }
+            emit(level, site, payload, output && _text_output.load(std::memory_order_relaxed), block);
+        }
+
+        // 按照fmt组织日志消息字符串, 写入线程局部缓冲区; 空间不足则按所需大小扩容后重新组织
+        static bool print(const std::string &fmt, va_list ap, std::string_view &result)
+        {
+            Buffer &payload = payloadBuffer();
+            payload.reset();
+            va_list cp;
+            va_copy(cp, ap);
+            char *res = payload.reserve(FORMAT_BUFFER_SIZE);
+            int ret = vsnprintf(res, payload.writeAbleSize(), fmt.c_str(), cp);
+            va_end(cp);
+            if (ret >= 0 && (size_t)ret >= payload.writeAbleSize())
+            {
+                res = payload.reserve(ret + 1);
+                va_copy(cp, ap);
+                ret = vsnprintf(res, payload.writeAbleSize(), fmt.c_str(), cp);
+                va_end(cp);
+            }
+            if (ret < 0)
+            {
+                std::cerr << "Logger.hpp::Logger::serialize: vsnprintf failed!" << std::endl;
+                return false;
+            }
+            result = std::string_view(res, ret);
+            return true;
+        }
+
+        // output: 是否交给落地方向; 需要记录的日志同时写入飞行记录器, FATAL日志写入后转储飞行记录器
+        void emit(LogLevel::value level, const CallSite &site, std::string_view payload, bool output,
+                  std::string_view block = std::string_view())
         {
+            bool record = FlightRecorder::wants(level);
+            if (output == false && record == false)
+            {
+                return;
+            }
+            static thread_local Buffer buf(FORMAT_BUFFER_SIZE);
             // 3. 构造LogMessage对象
-            LogMessage msg(level, line, file, _logger_name, str);
-            // 4. 通过格式化工具对LogMessage进行格式化, 得到格式化后的日志字符串
-            std::stringstream ss;
-            _formatter->format(ss, msg);
+            LogMessage msg(level, site, _logger_name, payload);
+            msg._fields = block;
+            // 4. 通过格式化工具对LogMessage进行格式化, 格式化结果直接写入缓冲区
+            buf.reset();
+            formatter().format(buf, msg);
+            if (record)
+            {
+                FlightRecorder::instance().capture(buf.begin(), buf.readAbleSize());
+            }
             // 5. 进行日志落地
-            log(ss.str().c_str(), ss.str().size());
+            if (output)
+            {
+                logMessage(msg, buf.begin(), buf.readAbleSize());
+            }
+            if (record && level == LogLevel::value::FATAL)
+            {
+                FlightRecorder::instance().dump("fatal");
+            }
+        }
+
+        // 在线程局部缓冲区中已经组织好的日志消息之后追加被抑制的条数, 返回完整的日志消息
+        static std::string_view suppressedSuffix(uint64_t suppressed)
+        {
+            Buffer &payload = payloadBuffer();
+            format::append(payload, " (");
+            format::append(payload, suppressed);
+            format::append(payload, " similar records suppressed)");
+            return std::string_view(payload.begin(), payload.readAbleSize());
+        }
+
+        // 日志消息字符串与日志记录使用的线程局部缓冲区, 所有日志器共用
+        static Buffer &payloadBuffer()
+        {
+            static thread_local Buffer payload(FORMAT_BUFFER_SIZE);
+            return payload;
+        }
+        static Buffer &recordBuffer()
+        {
+            static thread_local Buffer record(FORMAT_BUFFER_SIZE);
+            return record;
+        }
+        static Buffer &fieldsBuffer()
+        {
+            static thread_local Buffer block(FORMAT_BUFFER_SIZE);
+            return block;
         }
 
         // 抽象接口完成实际的落地输出 - 不同的日志器会有不同的实际落地方式
         virtual void log(const char *data, size_t len) = 0;
+        virtual void logRecord(const char *data, size_t len) = 0;
+        // 生产者线程中格式化好的日志: data是使用日志器格式化器的结果, 自带格式化器/等级的落地方向需要msg
+        virtual void logMessage(const LogMessage &msg, const char *data, size_t len)
+        {
+            log(data, len);
+        }
+
+        // 在_config_mutex内, 修改_sinks/_record_sinks之前调用, 之后由基类发布日志器的快照
+        // attach: 判断当前日志器能否支持该落地方向, 并更新派生类自己使用的快照
+        // detach: 派生类的快照中移除_sinks(record为true时为_record_sinks)中第index个落地方向
+        virtual bool attach(const LogSink::ptr &sink)
+        {
+            return true;
+        }
+        virtual void detach(bool record, size_t index)
+        {
+        }
+
+        // 在_config_mutex内调用: 按照_sinks/_record_sinks发布新的快照, 并更新生产者读取的标志
+        void refresh()
+        {
+            publish(_list, new SinkList(_sinks, _record_sinks), _mutex);
+            _text_output.store(_sinks.empty() == false, std::memory_order_relaxed);
+            _record_output.store(_record_sinks.empty() == false, std::memory_order_relaxed);
+        }
+        // 发布落地方向列表快照: 替换指针后获取一次写入方的落地锁, 之后的写入只能读到新快照, 旧快照随即释放
+        static void publish(std::atomic<SinkList *> &slot, SinkList *next, std::mutex &mutex)
+        {
+            SinkList *old = slot.exchange(next, std::memory_order_acq_rel);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+            }
+            delete old;
+        }
+        static std::vector<LogSink::ptr> appended(const std::vector<LogSink::ptr> &list, const LogSink::ptr &sink)
+        {
+            std::vector<LogSink::ptr> next(list);
+            next.push_back(sink);
+            return next;
+        }
+        static std::vector<LogSink::ptr> erased(const std::vector<LogSink::ptr> &list, size_t index)
+        {
+            std::vector<LogSink::ptr> next(list);
+            next.erase(next.begin() + index);
+            return next;
+        }
+
+        /*  当前的格式化器: 线程局部缓存持有格式化器的引用计数, 版本号不变时不读取共享的智能指针
+            缓存按日志器编号直接映射, 每个线程对每个槽位最多保留一个旧的格式化器, 替换次数再多也不会累积
+            返回的引用在当前线程下一次调用formatter()之前有效
+        */
+        Formatter &formatter()
+        {
+            struct Entry
+            {
+                size_t _id = 0;
+                uint64_t _version = 0;
+                Formatter::ptr _formatter;
+            };
+            static thread_local Entry cache[FORMATTER_CACHE_SIZE];
+            Entry &entry = cache[_id % FORMATTER_CACHE_SIZE];
+            uint64_t version = _formatter_version.load(std::memory_order_acquire);
+            if (entry._id != _id || entry._version != version)
+            {
+                entry._formatter = std::atomic_load_explicit(&_formatter, std::memory_order_acquire);
+                entry._id = _id;
+                entry._version = version;
+            }
+            return *entry._formatter;
+        }
+        static size_t nextId()
+        {
+            static std::atomic<size_t> id(0);
+            return ++id;
+        }
+
+        // 一批日志写入完毕(force为false)或显式刷新(force为true)时, 由落地方向按照持久化策略刷新
+        static void flushSinks(const std::vector<LogSink::ptr> &sinks, bool force)
+        {
+            for (auto &sink : sinks)
+            {
+                sink->flush(force);
+            }
+        }
+
+        // 将数据交给每个文本落地方向, 统计每次写入的耗时
+        void sinkLog(const std::vector<LogSink::ptr> &sinks, const char *data, size_t len)
+        {
+            for (auto &sink : sinks)
+            {
+                uint64_t start = statsClock();
+                sink->log(data, len);
+                _sink_latency.record(statsClock() - start);
+            }
+        }
+
+        // 将每一路格式化好的数据交给该路的落地方向
+        void sinkLog(SinkGroups &groups)
+        {
+            for (auto &lane : groups.lanes())
+            {
+                if (lane->_output.readAbleSize() > 0)
+                {
+                    sinkLog(lane->_sinks, lane->_output.begin(), lane->_output.readAbleSize());
+                }
+            }
+        }
+
+        // 将[data, data + len)中的日志记录逐条交给需要原始日志记录的落地方向(整批记录统计一次耗时)
+        void sinkRecords(const std::vector<LogSink::ptr> &sinks, const char *data, size_t len)
+        {
+            if (sinks.empty())
+            {
+                return;
+            }
+            uint64_t start = statsClock();
+            const char *ptr = data, *end = data + len;
+            RecordHeader hdr;
+            const char *body = nullptr;
+            while (Record::next(ptr, end, hdr, body))
+            {
+                for (auto &sink : sinks)
+                {
+                    if (hdr._level >= (uint8_t)sink->level())
+                    {
+                        sink->logRecord(_logger_name, hdr, body);
+                    }
+                }
+            }
+            _sink_latency.record(statsClock() - start);
+        }
 
     protected:
-        std::mutex _mutex;
+        std::mutex _mutex;        // 落地锁: 写入_list中的落地方向时持有(同步日志器的每次写入, 异步日志器的合并写入)
+        std::mutex _config_mutex; // 重新配置的操作之间互斥
         std::string _logger_name;
         std::atomic<LogLevel::value> _limit_level;
-        Formatter::ptr _formatter;
-        std::vector<LogSink::ptr> _sinks;
+        size_t _id;                                // 日志器编号, 用于区分线程缓存中的格式化器
+        Formatter::ptr _formatter;                 // 当前使用的格式化器(只通过atomic_load/atomic_store访问)
+        std::atomic<uint64_t> _formatter_version{0}; // 格式化器被替换的次数
+        std::vector<LogSink::ptr> _sinks;          // 接收格式化后字符串的落地方向(配置, 只在构造与_config_mutex内使用)
+        std::vector<LogSink::ptr> _record_sinks;   // 接收原始日志记录的落地方向(配置)
+        std::atomic<SinkList *> _list;             // 落地方向列表快照(在_mutex内读取, 通过publish替换)
+        std::atomic<bool> _text_output;            // 生产者判断是否存在两类落地方向, 不读取列表本身
+        std::atomic<bool> _record_output;
+        Histogram _sink_latency;                   // 单次写入落地方向的耗时(纳秒)
     };
 
     /*同步日志器*/
@@ -167,51 +598,568 @@ namespace tjq
         }
 
     protected:
-        // 同步日志器, 是将日志直接通过落地模块句柄进行日志落地
+        // 同步日志器, 是将日志直接通过落地模块句柄进行日志落地(在落地锁内取得落地方向快照)
         void log(const char *data, size_t len)
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            if (_sinks.empty())
+            SinkList &list = *_list.load(std::memory_order_acquire);
+            if (list._sinks.empty())
+                return;
+            sinkLog(list._sinks, data, len);
+            flushSinks(list._sinks, false);
+            _records.fetch_add(1, std::memory_order_relaxed);
+            _bytes.fetch_add(len, std::memory_order_relaxed);
+        }
+        // 存在自带格式化器/等级的落地方向时, 按格式化器分组格式化后分别落地
+        void logMessage(const LogMessage &msg, const char *data, size_t len) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            SinkList &list = *_list.load(std::memory_order_acquire);
+            if (list._sinks.empty())
                 return;
-            for (auto &sink : _sinks)
+            if (list._groups.plain())
             {
-                sink->log(data, len);
+                sinkLog(list._sinks, data, len);
             }
+            else
+            {
+                list._groups.reset();
+                list._groups.format(msg, formatter(), std::string_view(data, len));
+                sinkLog(list._groups);
+            }
+            flushSinks(list._sinks, false);
+            _records.fetch_add(1, std::memory_order_relaxed);
+            _bytes.fetch_add(len, std::memory_order_relaxed);
+        }
+        void logRecord(const char *data, size_t len)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            SinkList &list = *_list.load(std::memory_order_acquire);
+            sinkRecords(list._record_sinks, data, len);
+            flushSinks(list._record_sinks, false);
+            if (list._sinks.empty())
+            {
+                _records.fetch_add(1, std::memory_order_relaxed);
+                _bytes.fetch_add(len, std::memory_order_relaxed);
+            }
+        }
+
+    public:
+        void flush() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            SinkList &list = *_list.load(std::memory_order_acquire);
+            flushSinks(list._sinks, true);
+            flushSinks(list._record_sinks, true);
         }
+
+        LoggerStats stats() override
+        {
+            LoggerStats st = Logger::stats();
+            st._records = _records.load(std::memory_order_relaxed);
+            st._bytes = _bytes.load(std::memory_order_relaxed);
+            return st;
+        }
+
+    private:
+        std::atomic<uint64_t> _records{0}; // 落地的日志条数(同时有两类落地方向时按文本统计)
+        std::atomic<uint64_t> _bytes{0};
     };
 
-    /*异步日志器*/
+    /*  异步日志器
+        1. 默认只有一个异步工作器, 由一个工作线程完成所有落地操作
+        2. 分片模式: 创建多个异步工作器(分片), 生产线程按线程固定写入其中一个分片, 每个分片拥有独立的落地方向(输出分段)
+        3. 合并模式: 各分片并行完成格式化, 按日志产生的时间归并后, 由合并工作器统一写入共用的文本落地方向
+        4. 重复合并: 工作线程发现同一调用点连续的相同日志(生产者计算的摘要相同)时只计数, 不格式化也不写入文本落地方向,
+           重复结束(出现不同的日志)、持续超过COALESCE_INTERVAL秒或显式刷新时输出"last message repeated N times"
+           需要原始日志记录的落地方向仍然收到每一条记录
+    */
     class AsyncLogger : public Logger
     {
+    private:
+        // 分片上正在累计的重复
+        struct Repeat
+        {
+            RecordHeader _last{};  // 最后一条记录的记录头(_site为空表示还没有记录)
+            uint64_t _count = 0;   // 被合并的条数
+            uint64_t _since = 0;   // 本轮累计开始的时间(纳秒)
+        };
+
+        struct Shard
+        {
+            Shard()
+                : _payload(FORMAT_BUFFER_SIZE),
+                  _output(FORMAT_BUFFER_SIZE),
+                  _notice(FORMAT_BUFFER_SIZE)
+            {
+            }
+            ~Shard()
+            {
+                delete _list.load(std::memory_order_relaxed);
+            }
+            std::atomic<SinkList *> _list{nullptr};  // 分片的落地方向快照(合并模式下没有文本落地方向), 在_mutex内读取
+            SinkList *_active = nullptr;             // 工作线程在_mutex内取得的本批使用的快照
+            Repeat _repeat;                          // 重复合并的状态
+            Buffer _payload;                         // 工作线程还原日志消息使用的缓冲区
+            Buffer _output;                          // 合并模式下工作线程格式化结果缓冲区
+            Buffer _notice;                          // 丢弃提示的格式化结果(落地方向可能在刷新前一直引用_output)
+            Looper::ptr _looper;
+            std::mutex _mutex;                       // 工作线程落地与显式刷新互斥
+        };
+
     public:
         AsyncLogger(const std::string &logger_name, LogLevel::value level, Formatter::ptr &formatter, std::vector<LogSink::ptr> &sinks,
-                    AsyncType looper_type)
+                    AsyncType looper_type, LooperType looper = LooperType::LOOPER_BUFFER, bool deferred = false,
+                    std::chrono::milliseconds timeout = std::chrono::milliseconds(ASYNC_WAIT_TIMEOUT),
+                    size_t shards = 1, bool merge = false, bool coalesce = false)
             : Logger(logger_name, level, formatter, sinks),
-              _looper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::realLog, this, std::placeholders::_1), looper_type))
+              _coalesce(coalesce),
+              _report(0),
+              _reported_records(0),
+              _reported_bytes(0),
+              _last_report(0)
         {
+            shards = shards == 0 ? 1 : shards;
+            bool custom = std::any_of(_sinks.begin(), _sinks.end(), [](const LogSink::ptr &sink)
+                                      { return sink->custom(); });
+            // 合并模式只归并使用日志器格式化器的同一份输出, 存在自带格式化器/等级的落地方向时不合并
+            _merge = merge && shards > 1 && _sinks.empty() == false && custom == false;
+            // 原始日志记录只能在延迟格式化模式下保留, 合并模式与自带格式化器/等级的落地方向需要在工作线程中逐条格式化
+            _deferred = deferred || _record_sinks.empty() == false || _merge || custom || _coalesce;
+            if (_merge)
+            {
+                _merger = std::make_shared<StagingLooper>(std::bind(&AsyncLogger::mergeLog, this, std::placeholders::_1));
+            }
+            // 为每个分片准备落地方向(合并模式下文本落地方向只由合并工作器使用), 并创建对应的异步工作器
+            std::vector<std::vector<LogSink::ptr>> text = _merge ? std::vector<std::vector<LogSink::ptr>>(shards) : distribute(_sinks, shards);
+            std::vector<std::vector<LogSink::ptr>> record = distribute(_record_sinks, shards);
+            for (size_t i = 0; i < shards; i++)
+            {
+                std::unique_ptr<Shard> shard(new Shard());
+                shard->_list.store(new SinkList(text[i], record[i]), std::memory_order_release);
+                Functor cb = std::bind(&AsyncLogger::realLog, this, shard.get(), std::placeholders::_1);
+                // 根据工作器类型创建对应的异步工作器
+                if (looper == LooperType::LOOPER_RING)
+                {
+                    shard->_looper = std::make_shared<RingLooper>(cb);
+                }
+                else if (looper == LooperType::LOOPER_STAGING)
+                {
+                    shard->_looper = std::make_shared<StagingLooper>(cb);
+                }
+                else
+                {
+                    shard->_looper = std::make_shared<AsyncLooper>(cb, looper_type, timeout);
+                }
+                _shards.push_back(std::move(shard));
+            }
+        }
+        ~AsyncLogger()
+        {
+            // 等待工作线程处理完剩余日志后, 补充输出尚未提示的丢弃信息, 最后停止合并工作器
+            for (auto &shard : _shards)
+            {
+                shard->_looper->stop();
+            }
+            for (auto &shard : _shards)
+            {
+                shard->_active = shard->_list.load(std::memory_order_acquire);
+                shard->_active->_groups.reset();
+                reportRepeated(*shard);
+                if (shard == _shards[0])
+                {
+                    reportDropped(*shard, true);
+                }
+                sinkLog(shard->_active->_groups);
+                flushSinks(shard->_active->_sinks, false);
+                flushSinks(shard->_active->_record_sinks, false);
+                shard->_active = nullptr;
+            }
+            if (_merge)
+            {
+                _merger->stop();
+            }
         }
 
-        // 将数据写入缓冲区
+        // 将数据写入当前线程所属分片的缓冲区
         void log(const char *data, size_t len)
         {
-            _looper->push(data, len);
+            current()._looper->push(data, len);
+        }
+        void logRecord(const char *data, size_t len)
+        {
+            current()._looper->push(data, len);
         }
 
-        // 设计一个实际落地函数(将缓冲区中的数据落地)
-        void realLog(Buffer &buf)
+        // 依次等待各个分片(以及合并工作器)处理完调用之前写入的日志, 再刷新对应的落地方向
+        void flush() override
         {
-            if (_sinks.empty())
+            for (auto &shard : _shards)
+            {
+                shard->_looper->flush();
+                std::unique_lock<std::mutex> lock(shard->_mutex);
+                shard->_active = shard->_list.load(std::memory_order_acquire);
+                if (shard->_repeat._count > 0)
+                {
+                    shard->_active->_groups.reset();
+                    reportRepeated(*shard);
+                    sinkLog(shard->_active->_groups);
+                }
+                flushSinks(shard->_active->_sinks, true);
+                flushSinks(shard->_active->_record_sinks, true);
+                shard->_active = nullptr;
+            }
+            if (_merge)
+            {
+                _merger->flush();
+                std::unique_lock<std::mutex> lock(_mutex);
+                flushSinks(_list.load(std::memory_order_acquire)->_sinks, true);
+            }
+        }
+
+        // 各个分片工作器的统计(合并工作器处理的是分片已经统计过的日志, 不重复计入)
+        LoggerStats stats() override
+        {
+            LoggerStats st = Logger::stats();
+            st._async = true;
+            for (auto &shard : _shards)
+            {
+                st._loopers.push_back(shard->_looper->stats());
+                st._records += st._loopers.back()._records_out;
+                st._bytes += st._loopers.back()._bytes_out;
+            }
+            return st;
+        }
+
+    protected:
+        // 延迟格式化模式: 生产者只拷贝调用点信息与原始参数, 日志消息的组织与格式化都交给工作线程
+        void serialize(LogLevel::value level, const CallSite &site, const std::string &fmt, va_list ap) override
+        {
+            if (_deferred == false)
+            {
+                Logger::serialize(level, site, fmt, ap);
+                return;
+            }
+            if (level >= _limit_level.load(std::memory_order_relaxed))
+            {
+                Buffer &record = recordBuffer();
+                record.reset();
+                va_list cp;
+                va_copy(cp, ap);
+                Record::encode(record, level, site, fmt.c_str(), fmt.size(), cp);
+                va_end(cp);
+                if (_coalesce)
+                {
+                    Record::digest(record);
+                }
+                log(record.begin(), record.readAbleSize());
+            }
+            // 飞行记录器需要在生产者线程中得到格式化结果
+            std::string_view payload;
+            if (FlightRecorder::wants(level) && print(fmt, ap, payload))
+            {
+                emit(level, site, payload, false);
+            }
+        }
+        // 延迟格式化模式下, 已经组织好的日志消息作为文本类型的记录交给工作线程
+        void submit(LogLevel::value level, const CallSite &site, std::string_view payload, std::string_view block) override
+        {
+            if (_deferred == false)
+            {
+                Logger::submit(level, site, payload, block);
+                return;
+            }
+            if (level >= _limit_level.load(std::memory_order_relaxed))
+            {
+                Buffer &record = recordBuffer();
+                record.reset();
+                Record::encodeText(record, level, site, payload.data(), payload.size(), block);
+                if (_coalesce)
+                {
+                    Record::digest(record);
+                }
+                log(record.begin(), record.readAbleSize());
+            }
+            emit(level, site, payload, false, block);
+        }
+
+        /*  各分片快照中的落地方向列表与_sinks/_record_sinks一一对应(分片i的第k个落地方向由第k个落地方向派生), 添加时追加到末尾, 移除时按下标删除
+            1. 合并模式下文本落地方向只由合并工作器使用, 即日志器自己的快照(由基类发布)
+            2. 非延迟格式化模式下缓冲区中只有格式化结果, 无法添加需要原始日志记录或自带格式化器/等级的落地方向
+            3. 合并模式下无法添加自带格式化器/等级的文本落地方向
+        */
+        bool attach(const LogSink::ptr &sink) override
+        {
+            bool record = sink->needRecord();
+            if ((record || sink->custom()) && _deferred == false)
+            {
+                return false;
+            }
+            if (record == false && sink->custom() && _merge)
+            {
+                return false;
+            }
+            if (record || _merge == false)
+            {
+                std::vector<LogSink::ptr> one(1, sink);
+                std::vector<std::vector<LogSink::ptr>> parts = distribute(one, _shards.size());
+                for (size_t i = 0; i < _shards.size(); i++)
+                {
+                    Shard &shard = *_shards[i];
+                    SinkList *cur = shard._list.load(std::memory_order_relaxed);
+                    if (record)
+                        publish(shard._list, new SinkList(cur->_sinks, appended(cur->_record_sinks, parts[i][0])), shard._mutex);
+                    else
+                        publish(shard._list, new SinkList(appended(cur->_sinks, parts[i][0]), cur->_record_sinks), shard._mutex);
+                }
+            }
+            return true;
+        }
+        void detach(bool record, size_t index) override
+        {
+            if (record == false && _merge)
             {
                 return;
             }
-            for (auto &sink : _sinks)
+            for (auto &shard : _shards)
             {
-                sink->log(buf.begin(), buf.readAbleSize());
+                SinkList *cur = shard->_list.load(std::memory_order_relaxed);
+                if (record)
+                    publish(shard->_list, new SinkList(cur->_sinks, erased(cur->_record_sinks, index)), shard->_mutex);
+                else
+                    publish(shard->_list, new SinkList(erased(cur->_sinks, index), cur->_record_sinks), shard->_mutex);
             }
         }
 
     private:
-        AsyncLooper::ptr _looper;
+        // 当前线程所属的分片: 线程第一次打印日志时按顺序分配编号, 之后固定写入同一个分片, 保证单个线程的日志有序
+        Shard &current()
+        {
+            if (_shards.size() == 1)
+            {
+                return *_shards[0];
+            }
+            static std::atomic<size_t> count(0);
+            static thread_local size_t index = count.fetch_add(1, std::memory_order_relaxed);
+            return *_shards[index % _shards.size()];
+        }
+
+        // 支持分片的落地方向: 第0个分片使用原对象, 其余分片各自创建独立的输出分段; 不支持的则所有分片共用并加锁
+        // 派生出的落地方向沿用原对象的格式化器与输出等级
+        static std::vector<std::vector<LogSink::ptr>> distribute(std::vector<LogSink::ptr> &sinks, size_t count)
+        {
+            std::vector<std::vector<LogSink::ptr>> result(count);
+            for (auto &sink : sinks)
+            {
+                auto inherit = [&sink](LogSink::ptr derived)
+                {
+                    derived->setFormatter(sink->formatter());
+                    derived->setLevel(sink->level());
+                    return derived;
+                };
+                LogSink::ptr first = count > 1 ? sink->shard(1) : LogSink::ptr();
+                if (count > 1 && first.get() == nullptr)
+                {
+                    LogSink::ptr shared = inherit(std::make_shared<SharedSink>(sink));
+                    for (auto &list : result)
+                    {
+                        list.push_back(shared);
+                    }
+                    continue;
+                }
+                result[0].push_back(sink);
+                for (size_t i = 1; i < count; i++)
+                {
+                    result[i].push_back(inherit(i == 1 ? first : sink->shard(i)));
+                }
+            }
+            return result;
+        }
+
+        // 分片工作线程: 实际落地函数(将缓冲区中的数据落地)
+        void realLog(Shard *shard, Buffer &buf)
+        {
+            std::unique_lock<std::mutex> lock(shard->_mutex);
+            shard->_active = shard->_list.load(std::memory_order_acquire);
+            SinkList &active = *shard->_active;
+            if (_deferred)
+            {
+                // 延迟格式化模式下, 缓冲区中是日志记录, 需要先在工作线程中按格式化器分组完成格式化
+                // 丢弃提示与本批日志一起格式化后写入
+                sinkRecords(active._record_sinks, buf.begin(), buf.readAbleSize());
+                active._groups.reset();
+                if (_merge || active._groups.empty() == false)
+                {
+                    formatRecords(*shard, buf);
+                }
+                if (shard->_repeat._count > 0 && tool::Clock::now() - shard->_repeat._since >= (uint64_t)COALESCE_INTERVAL * 1000000000)
+                {
+                    reportRepeated(*shard);
+                }
+                reportDropped(*shard);
+                sinkLog(active._groups);
+            }
+            else
+            {
+                sinkLog(active._sinks, buf.begin(), buf.readAbleSize());
+                reportDropped(*shard);
+            }
+            // 整批日志写入完毕后才按照持久化策略刷新, 一次刷新/同步覆盖整批日志
+            flushSinks(active._sinks, false);
+            flushSinks(active._record_sinks, false);
+            shard->_active = nullptr;
+        }
+
+        // 合并工作线程: 归并后的日志写入共用的文本落地方向
+        void mergeLog(Buffer &buf)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            SinkList &list = *_list.load(std::memory_order_acquire);
+            sinkLog(list._sinks, buf.begin(), buf.readAbleSize());
+            flushSinks(list._sinks, false);
+        }
+
+        // 分片工作线程: 对缓冲区中的日志记录逐条还原日志消息并格式化, 合并模式下逐条交给合并工作器
+        void formatRecords(Shard &shard, Buffer &buf)
+        {
+            shard._output.reset();
+            const char *ptr = buf.begin(), *end = buf.begin() + buf.readAbleSize();
+            RecordHeader hdr;
+            const char *body = nullptr;
+            while (Record::next(ptr, end, hdr, body))
+            {
+                if (_coalesce && repeated(shard, hdr))
+                {
+                    continue;
+                }
+                shard._payload.reset();
+                std::string_view payload = Record::payload(shard._payload, hdr, body);
+                LogMessage msg((LogLevel::value)hdr._level, *hdr._site, _logger_name, payload, hdr._stamp, hdr._tid);
+                msg._fields = Record::fields(hdr, body);
+                formatMessage(shard, msg);
+            }
+        }
+
+        // 分片工作线程: 合并模式下格式化后交给合并工作器, 否则按格式化器分组格式化
+        void formatMessage(Shard &shard, const LogMessage &msg)
+        {
+            if (_merge == false)
+            {
+                shard._active->_groups.format(msg, formatter());
+                return;
+            }
+            size_t start = shard._output.readAbleSize();
+            formatter().format(shard._output, msg);
+            _merger->push(msg._stamp, shard._output.begin() + start, shard._output.readAbleSize() - start);
+        }
+
+        // 分片工作线程: 与上一条记录来自同一调用点且内容相同(等级/长度/摘要都相同)时只计数;
+        // 否则先输出之前累计的重复提示, 再记住这条记录
+        bool repeated(Shard &shard, const RecordHeader &hdr)
+        {
+            Repeat &rep = shard._repeat;
+            if (rep._last._site == hdr._site && rep._last._hash == hdr._hash && rep._last._size == hdr._size &&
+                rep._last._level == hdr._level && rep._last._kind == hdr._kind)
+            {
+                rep._since = rep._count == 0 ? tool::Clock::now() : rep._since;
+                rep._count++;
+                rep._last = hdr;
+                return true;
+            }
+            reportRepeated(shard);
+            rep._last = hdr;
+            return false;
+        }
+
+        // 分片工作线程: 输出累计的重复提示(使用最后一条重复记录的等级/调用点/时间/线程)
+        void reportRepeated(Shard &shard)
+        {
+            Repeat &rep = shard._repeat;
+            if (rep._count == 0)
+            {
+                return;
+            }
+            shard._payload.reset();
+            format::append(shard._payload, "last message repeated ");
+            format::append(shard._payload, rep._count);
+            format::append(shard._payload, rep._count == 1 ? " time" : " times");
+            LogMessage msg((LogLevel::value)rep._last._level, *rep._last._site, _logger_name,
+                           std::string_view(shard._payload.begin(), shard._payload.readAbleSize()), rep._last._stamp, rep._last._tid);
+            formatMessage(shard, msg);
+            rep._count = 0;
+        }
+
+        // 分片工作线程: 有日志因缓冲区满被丢弃时, 最多每隔DROP_REPORT_INTERVAL秒输出一条提示(force为true时忽略间隔)
+        void reportDropped(Shard &shard, bool force = false)
+        {
+            uint64_t records = 0, bytes = 0;
+            for (auto &item : _shards)
+            {
+                records += item->_looper->droppedRecords();
+                bytes += item->_looper->droppedBytes();
+            }
+            if (records == _reported_records.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(_report_mutex);
+            uint64_t now = tool::Clock::now();
+            if (records == _reported_records.load(std::memory_order_relaxed) ||
+                (force == false && now - _last_report < (uint64_t)DROP_REPORT_INTERVAL * 1000000000))
+            {
+                return;
+            }
+            _report.reset();
+            format::append(_report, records - _reported_records);
+            format::append(_report, " records (");
+            format::append(_report, bytes - _reported_bytes);
+            format::append(_report, " bytes) dropped due to async buffer overflow");
+            _reported_records.store(records, std::memory_order_relaxed);
+            _reported_bytes = bytes;
+            _last_report = now;
+            static CallSite site(__FILE__, __LINE__, LogLevel::value::WARN);
+            std::string_view text(_report.begin(), _report.readAbleSize());
+            SinkList &active = *shard._active;
+            if (active._record_sinks.empty() == false)
+            {
+                Buffer &record = recordBuffer();
+                record.reset();
+                Record::encodeText(record, LogLevel::value::WARN, site, text.data(), text.size());
+                sinkRecords(active._record_sinks, record.begin(), record.readAbleSize());
+            }
+            if (_merge || active._sinks.empty() == false)
+            {
+                LogMessage msg(LogLevel::value::WARN, site, _logger_name, text);
+                shard._notice.reset();
+                formatter().format(shard._notice, msg);
+                if (_merge)
+                {
+                    _merger->push(msg._stamp, shard._notice.begin(), shard._notice.readAbleSize());
+                    return;
+                }
+                if (_deferred)
+                {
+                    active._groups.format(msg, formatter(), std::string_view(shard._notice.begin(), shard._notice.readAbleSize()));
+                    return;
+                }
+                for (auto &sink : active._sinks)
+                {
+                    sink->log(shard._notice.begin(), shard._notice.readAbleSize());
+                }
+            }
+        }
+
+    private:
+        bool _coalesce;                           // 是否合并连续的重复日志
+        bool _deferred;                           // 是否延迟格式化
+        bool _merge;                              // 是否按时间归并各分片的日志
+        std::vector<std::unique_ptr<Shard>> _shards;
+        StagingLooper::ptr _merger;               // 合并工作器(仅合并模式)
+        std::mutex _report_mutex;
+        Buffer _report;                           // 丢弃提示消息
+        std::atomic<uint64_t> _reported_records;  // 已经提示过的丢弃条数
+        uint64_t _reported_bytes;                 // 已经提示过的丢弃字节数
+        uint64_t _last_report;                    // 上一次提示的时间(纳秒)
     };
 
     /*  使用建造者模式来建造日志器, 而不要让用户直接去构造日志器, 简化用户的使用复杂度
@@ -229,6 +1177,12 @@ namespace tjq
     public:
         LoggerBuilder()
             : _looper_type(AsyncType::ASYNC_SAFE),
+              _timeout(ASYNC_WAIT_TIMEOUT),
+              _looper(LooperType::LOOPER_BUFFER),
+              _deferred(false),
+              _shards(1),
+              _merge(false),
+              _coalesce(false),
               _logger_type(LoggerType::LOGGER_SYNC),
               _limit_level(LogLevel::value::DEBUG)
         {
@@ -237,6 +1191,35 @@ namespace tjq
         {
             _looper_type = AsyncType::ASYNC_UNSAFE;
         }
+        // 设置异步缓冲区满了之后的处理策略, timeout为ASYNC_BLOCK_TIMEOUT策略的等待时间
+        // 只有双缓冲区工作器支持全部策略, 环形队列/线程暂存区工作器满了总是等待
+        void buildOverflowPolicy(AsyncType type, std::chrono::milliseconds timeout = std::chrono::milliseconds(ASYNC_WAIT_TIMEOUT))
+        {
+            _looper_type = type;
+            _timeout = timeout;
+        }
+        // 设置异步工作器类型(默认使用双缓冲区工作器)
+        void buildLooperType(LooperType looper)
+        {
+            _looper = looper;
+        }
+        // 设置异步日志器的分片数量: 每个分片拥有独立的工作线程与落地方向(支持分片的落地方向写入独立的输出分段)
+        // merge为true时, 各分片只负责格式化, 按日志产生的时间归并后写入共用的文本落地方向
+        void buildShards(size_t count, bool merge = false)
+        {
+            _shards = count;
+            _merge = merge;
+        }
+        // 开启延迟格式化(仅异步日志器有效): 日志消息的组织与格式化都在异步工作线程中完成
+        void buildEnableDeferredFormat()
+        {
+            _deferred = true;
+        }
+        // 开启重复合并(仅异步日志器有效, 同时开启延迟格式化): 同一调用点连续输出的相同日志合并为一条重复提示
+        void buildEnableCoalesce()
+        {
+            _coalesce = true;
+        }
         void buildLoggerType(LoggerType type)
         {
             _logger_type = type;
@@ -253,16 +1236,33 @@ namespace tjq
         {
             _formatter = std::make_shared<Formatter>(pattern);
         }
+        // 使用编译期解析的格式化规则, 规则错误则编译失败
+        template <const char *Pattern>
+        void buildFormatter()
+        {
+            _formatter = std::make_shared<StaticFormatter<Pattern>>();
+        }
         template <typename SinkType, typename... Args>
         void buildSink(Args &&...args)
         {
             LogSink::ptr psink = SinkFactory::create<SinkType>(std::forward<Args>(args)...);
             _sinks.push_back(psink);
         }
+        // 添加已经创建好的落地方向, 例如设置了自己的格式化器与输出等级的落地方向
+        void buildSink(const LogSink::ptr &sink)
+        {
+            _sinks.push_back(sink);
+        }
         virtual Logger::ptr build() = 0;
 
     protected:
         AsyncType _looper_type;
+        std::chrono::milliseconds _timeout;
+        LooperType _looper;
+        bool _deferred;
+        size_t _shards;
+        bool _merge;
+        bool _coalesce;
         LoggerType _logger_type;
         std::string _logger_name;
         std::atomic<LogLevel::value> _limit_level;
@@ -286,16 +1286,24 @@ namespace tjq
             }
             if (_logger_type == LoggerType::LOGGER_ASYNC)
             {
-                return std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _looper_type);
+                return std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _looper_type, _looper, _deferred, _timeout, _shards, _merge, _coalesce);
             }
             return std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter, _sinks);
         }
     };
 
     /*全局日志管理器*/
+    /*  日志器管理器: 读多写少的注册表
+        1. 注册表以写时复制的快照发布: 添加日志器时在锁内拷贝当前快照, 插入后原子地替换快照指针(release)
+        2. 查找只是一次acquire读取快照指针, 不加锁也不修改引用计数, 不与添加日志器互斥;
+           快照发布后不再修改, 被替换的旧快照保留到管理器析构(每次添加日志器保留一份, 日志器数量有限, 以少量内存换取无锁查找)
+        3. 热点路径上可以使用LoggerHandle缓存日志器, 之后每次使用都不再查找, 也不拷贝智能指针
+    */
     class LoggerManager
     {
     public:
+        using Registry = std::unordered_map<std::string, Logger::ptr>;
+
         static LoggerManager &getInstance()
         {
             // 在C++11之后, 针对静态局部变量, 编译器在编译的层面实现了线程安全
@@ -304,56 +1312,259 @@ namespace tjq
             return eton;
         }
 
-        void addLogger(Logger::ptr &logger)
+        // 添加日志器, 同名的日志器已经存在则不添加并返回false(检查与插入在同一次加锁中完成)
+        bool addLogger(const Logger::ptr &logger)
         {
-            if (hasLogger(logger->name()))
+            std::unique_lock<std::mutex> lock(_mutex);
+            const Registry &current = registry();
+            if (current.find(logger->name()) != current.end())
             {
-                return;
+                return false;
             }
-            std::unique_lock<std::mutex> lock(_mutex);
-            _loggers.insert(std::make_pair(logger->name(), logger));
+            _snapshots.emplace_back(new Registry(current));
+            _snapshots.back()->insert(std::make_pair(logger->name(), logger));
+            _registry.store(_snapshots.back().get(), std::memory_order_release);
+            return true;
         }
 
         bool hasLogger(const std::string &name)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _loggers.find(name);
-            if (it == _loggers.end())
-            {
-                return false;
-            }
-            return true;
+            return findLogger(name) != nullptr;
         }
 
         Logger::ptr getLogger(const std::string &name)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            auto it = _loggers.find(name);
-            if (it == _loggers.end())
+            const Registry &current = registry();
+            auto it = current.find(name);
+            if (it == current.end())
             {
                 return Logger::ptr();
             }
             return it->second;
         }
 
-        Logger::ptr rootLogger()
+        // 不拷贝日志器智能指针的查找, 没有则返回nullptr; 日志器注册后不会被移除, 指针在程序运行期间一直有效
+        Logger *findLogger(const std::string &name)
+        {
+            const Registry &current = registry();
+            auto it = current.find(name);
+            return it == current.end() ? nullptr : it->second.get();
+        }
+
+        // 返回引用, 避免每次打印日志都拷贝智能指针
+        const Logger::ptr &rootLogger()
         {
             return _root_logger;
         }
 
+        // 所有日志器的运行时统计快照
+        std::vector<LoggerStats> stats()
+        {
+            std::vector<LoggerStats> result;
+            for (auto &it : registry())
+            {
+                result.push_back(it.second->stats());
+            }
+            return result;
+        }
+
+        /*  周期性自我报告: 后台线程每隔interval通过target日志器(INFO等级)为每个日志器输出一行统计摘要
+            重复调用会替换之前的报告设置, interval为0则停止报告
+        */
+        void reportStats(std::chrono::milliseconds interval, const std::string &target = "root")
+        {
+            _reporter.start(interval, [this, target]()
+                            {
+                                Logger::ptr logger = getLogger(target);
+                                if (logger.get() == nullptr)
+                                {
+                                    return;
+                                }
+                                static CallSite site(__FILE__, __LINE__, LogLevel::value::INFO);
+                                for (auto &st : stats())
+                                {
+                                    logger->info(site, "%s", st.toString().c_str());
+                                }
+                            });
+        }
+
+        /*  监视等级配置文件: 后台线程每隔interval检查文件的修改时间, 发生变化后重新读取, 调整对应日志器的输出等级
+            文件每行为"日志器名称=等级"(如 room=DEBUG), '#'开头的行为注释; 未注册的日志器与无法识别的等级被忽略
+            不需要重启进程即可打开某个子系统的调试日志; 重复调用会替换之前的设置, interval为0则停止监视
+        */
+        void watchLevels(const std::string &path, std::chrono::milliseconds interval)
+        {
+            std::shared_ptr<int64_t> mtime = std::make_shared<int64_t>(-1);
+            _watcher.start(interval, [this, path, mtime]()
+                           {
+                               struct stat st;
+                               if (stat(path.c_str(), &st) < 0 || (int64_t)st.st_mtime == *mtime)
+                               {
+                                   return;
+                               }
+                               *mtime = st.st_mtime;
+                               applyLevels(path);
+                           });
+        }
+
+        // 读取等级配置文件并立即生效, 返回调整的日志器数量
+        size_t applyLevels(const std::string &path)
+        {
+            std::ifstream ifs(path);
+            std::string line;
+            size_t count = 0;
+            while (std::getline(ifs, line))
+            {
+                size_t pos = line.find('=');
+                if (line.empty() || line[0] == '#' || pos == std::string::npos)
+                {
+                    continue;
+                }
+                Logger *logger = findLogger(trim(line.substr(0, pos)));
+                LogLevel::value level = LogLevel::fromString(trim(line.substr(pos + 1)));
+                if (logger != nullptr && level != LogLevel::value::UNKNOW)
+                {
+                    logger->setLevel(level);
+                    count++;
+                }
+            }
+            return count;
+        }
+
     private:
+        // 后台周期任务: 每隔interval执行一次task, 直到被替换或停止
+        class Periodic
+        {
+        public:
+            ~Periodic()
+            {
+                stop();
+            }
+            void start(std::chrono::milliseconds interval, const std::function<void()> &task)
+            {
+                stop();
+                if (interval.count() <= 0)
+                {
+                    return;
+                }
+                _stop = false;
+                _thread = std::thread([this, interval, task]()
+                                      {
+                                          std::unique_lock<std::mutex> lock(_mutex);
+                                          while (_cond.wait_for(lock, interval, [this]()
+                                                                { return _stop; }) == false)
+                                          {
+                                              lock.unlock();
+                                              task();
+                                              lock.lock();
+                                          } });
+            }
+            void stop()
+            {
+                if (_thread.joinable() == false)
+                {
+                    return;
+                }
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _stop = true;
+                }
+                _cond.notify_all();
+                _thread.join();
+            }
+
+        private:
+            std::thread _thread;
+            std::mutex _mutex;
+            std::condition_variable _cond;
+            bool _stop = false;
+        };
+
         LoggerManager()
         {
             std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
             builder->buildLoggerName("root");
             _root_logger = builder->build();
-            _loggers.insert(std::make_pair("root", _root_logger));
+            _snapshots.emplace_back(new Registry());
+            _snapshots.back()->insert(std::make_pair("root", _root_logger));
+            _registry.store(_snapshots.back().get(), std::memory_order_release);
+        }
+        ~LoggerManager()
+        {
+            _reporter.stop();
+            _watcher.stop();
+        }
+
+        // 当前的注册表快照
+        const Registry &registry()
+        {
+            return *_registry.load(std::memory_order_acquire);
+        }
+
+        static std::string trim(const std::string &str)
+        {
+            size_t start = str.find_first_not_of(" \t\r");
+            if (start == std::string::npos)
+            {
+                return std::string();
+            }
+            return str.substr(start, str.find_last_not_of(" \t\r") - start + 1);
+        }
+
+    private:
+        std::mutex _mutex;                                 // 添加日志器时互斥
+        Logger::ptr _root_logger;                          // 默认日志器
+        std::atomic<const Registry *> _registry{nullptr}; // 当前的注册表快照
+        std::vector<std::unique_ptr<Registry>> _snapshots; // 发布过的全部快照(只追加, 添加日志器时在锁内修改)
+        Periodic _reporter;                                // 周期性自我报告
+        Periodic _watcher;                                 // 等级配置文件监视
+    };
+
+    /*  日志器句柄: 保存日志器名称, 第一次找到日志器后缓存其指针, 之后的使用不再查找, 适合定义为静态对象
+        static tjq::LoggerHandle net("net");
+        LOG_INFO(net, "connection {} closed", fd);
+        日志器还没有注册时使用默认日志器(不缓存), 注册之后自动切换
+    */
+    class LoggerHandle
+    {
+    public:
+        explicit LoggerHandle(const std::string &name)
+            : _name(name),
+              _logger(nullptr)
+        {
+        }
+
+        Logger &get() const
+        {
+            Logger *logger = _logger.load(std::memory_order_acquire);
+            if (logger != nullptr)
+            {
+                return *logger;
+            }
+            logger = LoggerManager::getInstance().findLogger(_name);
+            if (logger == nullptr)
+            {
+                return *LoggerManager::getInstance().rootLogger();
+            }
+            _logger.store(logger, std::memory_order_release);
+            return *logger;
+        }
+        Logger &operator*() const
+        {
+            return get();
+        }
+        Logger *operator->() const
+        {
+            return &get();
+        }
+        const std::string &name() const
+        {
+            return _name;
         }
 
     private:
-        std::mutex _mutex;
-        Logger::ptr _root_logger; // 默认日志器
-        std::unordered_map<std::string, Logger::ptr> _loggers;
+        std::string _name;
+        mutable std::atomic<Logger *> _logger;
     };
 
     // 设计一个全局日志器的建造者 - 在局部的基础上增加了一个功能: 将日志器添加到单例对象中
@@ -374,7 +1585,7 @@ namespace tjq
             Logger::ptr logger;
             if (_logger_type == LoggerType::LOGGER_ASYNC)
             {
-                logger = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _looper_type);
+                logger = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _looper_type, _looper, _deferred, _timeout, _shards, _merge, _coalesce);
             }
             else
             {
@@ -1,31 +1,143 @@
 #ifndef __M_LOOPER_H__
 #define __M_LOOPER_H__
 
-/*实现异步工作器*/
+/*  实现异步工作器
+    1. AsyncLooper: 双缓冲区工作器, 生产者加锁写入生产缓冲区, 工作线程交换缓冲区后处理
+    2. RingLooper: 无锁环形队列工作器, 生产者通过原子操作预留槽位, 工作线程批量取出数据处理
+    3. StagingLooper: 线程暂存区工作器, 每个生产线程独占一个暂存区, 工作线程定期收集并按时间戳归并(同一轮收集内有序)
+*/
 
 #include <mutex>
+#include <atomic>
 #include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <deque>
+#include <vector>
 #include <functional>
 #include <condition_variable>
 #include "Buffer.hpp"
+#include "Stats.hpp"
 
 namespace tjq
 {
     using Functor = std::function<void(Buffer &)>;
 
+#define ASYNC_WAIT_TIMEOUT 10            // ASYNC_BLOCK_TIMEOUT策略默认的等待时间(毫秒)
+#define ASYNC_DROP_CHUNK_SIZE (64 * 1024) // ASYNC_DROP_OLDEST策略一次丢弃的数据量
+
+    // 异步工作器缓冲区满了之后的处理策略(仅双缓冲区工作器支持全部策略)
     enum class AsyncType
     {
-        ASYNC_SAFE,  // 安全状态, 表示缓冲区满了则阻塞, 避免资源耗尽的风险
-        ASYNC_UNSAFE // 不考虑资源耗尽的问题, 无限扩容, 常用于测试
+        ASYNC_SAFE,          // 安全状态, 表示缓冲区满了则阻塞, 避免资源耗尽的风险
+        ASYNC_UNSAFE,        // 不考虑资源耗尽的问题, 无限扩容, 常用于测试
+        ASYNC_DROP_NEWEST,   // 丢弃当前写入的日志, 生产者从不阻塞
+        ASYNC_DROP_OLDEST,   // 按块丢弃生产缓冲区中最早的日志, 为新日志腾出空间
+        ASYNC_BLOCK_TIMEOUT, // 阻塞等待, 超时后丢弃当前写入的日志
+        ASYNC_DEGRADE_SYNC   // 由生产者线程直接落地(连同缓冲区中的数据), 退化为同步日志器
+    };
+
+    enum class LooperType
+    {
+        LOOPER_BUFFER, // 双缓冲区工作器(加锁)
+        LOOPER_RING,   // 无锁环形队列工作器(固定大小, 满了则等待)
+        LOOPER_STAGING // 线程暂存区工作器(每个线程独立写入, 工作线程按时间戳归并)
+    };
+
+    // 异步工作器抽象基类 - 不同实现的工作器对异步日志器提供相同的接口
+    class Looper
+    {
+    public:
+        using ptr = std::shared_ptr<Looper>;
+        virtual ~Looper()
+        {
+        }
+        virtual void push(const char *data, size_t len) = 0;
+        virtual void stop() = 0;
+        // 等待调用之前写入的数据全部交给回调处理完毕
+        virtual void flush() = 0;
+
+        // 因缓冲区满而被丢弃的日志条数/字节数
+        uint64_t droppedRecords()
+        {
+            return _dropped_records.load(std::memory_order_relaxed);
+        }
+        uint64_t droppedBytes()
+        {
+            return _dropped_bytes.load(std::memory_order_relaxed);
+        }
+
+        // 运行时统计快照
+        virtual LooperStats stats()
+        {
+            LooperStats st;
+            st._records_in = _records_in.load(std::memory_order_relaxed);
+            st._bytes_in = _bytes_in.load(std::memory_order_relaxed);
+            st._records_out = _records_out.load(std::memory_order_relaxed);
+            st._bytes_out = _bytes_out.load(std::memory_order_relaxed);
+            st._waits = _waits.load(std::memory_order_relaxed);
+            st._wait_ns = _wait_ns.load(std::memory_order_relaxed);
+            st._buffer_growths = _growths.load(std::memory_order_relaxed);
+            st._dropped_records = droppedRecords();
+            st._dropped_bytes = droppedBytes();
+            st._batch_bytes = _batch_bytes.snapshot();
+            return st;
+        }
+
+    protected:
+        void drop(uint64_t records, uint64_t bytes)
+        {
+            _dropped_records.fetch_add(records, std::memory_order_relaxed);
+            _dropped_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        void countIn(uint64_t records, uint64_t bytes)
+        {
+            _records_in.fetch_add(records, std::memory_order_relaxed);
+            _bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        // 一批数据处理完毕
+        void countOut(uint64_t records, uint64_t bytes)
+        {
+            _records_out.fetch_add(records, std::memory_order_relaxed);
+            _bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+            _batch_bytes.record(bytes);
+        }
+        // 生产者等待了ns纳秒(只在缓冲区满的慢路径上计时)
+        void countWait(uint64_t ns)
+        {
+            _waits.fetch_add(1, std::memory_order_relaxed);
+            _wait_ns.fetch_add(ns, std::memory_order_relaxed);
+        }
+        void countGrowth()
+        {
+            _growths.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> _dropped_records{0};
+        std::atomic<uint64_t> _dropped_bytes{0};
+        std::atomic<uint64_t> _records_in{0};
+        std::atomic<uint64_t> _bytes_in{0};
+        std::atomic<uint64_t> _records_out{0};
+        std::atomic<uint64_t> _bytes_out{0};
+        std::atomic<uint64_t> _waits{0};
+        std::atomic<uint64_t> _wait_ns{0};
+        std::atomic<uint64_t> _growths{0};
+        Histogram _batch_bytes;
     };
 
-    class AsyncLooper
+    class AsyncLooper : public Looper
     {
     public:
         using ptr = std::shared_ptr<AsyncLooper>;
-        AsyncLooper(const Functor &cb, AsyncType loop_type = AsyncType::ASYNC_SAFE)
+        AsyncLooper(const Functor &cb, AsyncType loop_type = AsyncType::ASYNC_SAFE,
+                    std::chrono::milliseconds timeout = std::chrono::milliseconds(ASYNC_WAIT_TIMEOUT))
             : _looper_type(loop_type),
+              _timeout(timeout),
               _stop(false),
+              _sync_buf(loop_type == AsyncType::ASYNC_DEGRADE_SYNC ? DEFAULT_BUFFER_SIZE : 0),
               _thread(std::thread(&AsyncLooper::threadEntry, this)),
               _callBack(cb)
         {
@@ -35,26 +147,94 @@ namespace tjq
             stop();
         }
 
-        void stop()
+        void stop() override
         {
+            if (_thread.joinable() == false)
+            {
+                return;
+            }
             _stop = true;           // 将退出标志设置为true
             _cond_con.notify_all(); // 唤醒所有的工作线程
             _thread.join();         // 等待工作线程的退出
         }
 
-        void push(const char *data, size_t len)
+        void flush() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            uint64_t target = _pushed;
+            _cond_flush.wait(lock, [&]()
+                             { return _done >= target; });
+        }
+
+        LooperStats stats() override
+        {
+            LooperStats st = Looper::stats();
+            std::unique_lock<std::mutex> lock(_mutex);
+            st._pending_bytes = _pro_buf.readAbleSize();
+            return st;
+        }
+
+        void push(const char *data, size_t len) override
         {
             // 1. 无线扩容 - 非安全
-            // 2. 固定大小 - 生产缓冲区中数据满了就阻塞
+            // 2. 固定大小 - 生产缓冲区中数据满了则按照策略处理
             std::unique_lock<std::mutex> lock(_mutex);
-            // 条件变量控制, 若缓冲区剩余空间大小大于数据长度, 则可以添加数据
-            if (_looper_type == AsyncType::ASYNC_SAFE)
+            if (_looper_type != AsyncType::ASYNC_UNSAFE && fits(len) == false)
             {
-                _cond_pro.wait(lock, [&]()
-                               { return _pro_buf.writeAbleSize() >= len; });
+                switch (_looper_type)
+                {
+                case AsyncType::ASYNC_SAFE:
+                {
+                    // 条件变量控制, 若缓冲区剩余空间大小大于数据长度, 则可以添加数据
+                    uint64_t start = statsClock();
+                    _cond_pro.wait(lock, [&]()
+                                   { return fits(len); });
+                    countWait(statsClock() - start);
+                    break;
+                }
+                case AsyncType::ASYNC_BLOCK_TIMEOUT:
+                {
+                    uint64_t start = statsClock();
+                    bool ready = _cond_pro.wait_for(lock, _timeout, [&]()
+                                                    { return fits(len); });
+                    countWait(statsClock() - start);
+                    if (ready == false)
+                    {
+                        drop(1, len);
+                        return;
+                    }
+                    break;
+                }
+                case AsyncType::ASYNC_DROP_OLDEST:
+                    dropOldest(len);
+                    if (fits(len) == false)
+                    {
+                        drop(1, len);
+                        return;
+                    }
+                    break;
+                case AsyncType::ASYNC_DEGRADE_SYNC:
+                    lock.unlock();
+                    degrade(data, len);
+                    return;
+                default: // ASYNC_DROP_NEWEST
+                    drop(1, len);
+                    return;
+                }
             }
             // 走到这里代表满足了条件, 可以向缓冲区添加数据
+            size_t capacity = _pro_buf.capacity();
             _pro_buf.push(data, len);
+            _pushed++;
+            countIn(1, len);
+            if (_pro_buf.capacity() != capacity)
+            {
+                countGrowth();
+            }
+            if (_looper_type == AsyncType::ASYNC_DROP_OLDEST)
+            {
+                mark(len);
+            }
             // 唤醒消费者缓冲区中的数据进行处理
             _cond_con.notify_one();
         }
@@ -67,7 +247,7 @@ namespace tjq
             {
                 // 为互斥锁设置一个生命周期, 当缓冲区交换完毕后就解锁(并不对数据的处理过程加锁保护)
                 {
-                    // 1. 判断生产缓冲区有没有数据, 有则交换, 无则阻塞
+                    // 1. 判断生产缓冲区有没有数据, 有则向下运行, 无则阻塞
                     std::unique_lock<std::mutex> lock(_mutex);
                     // 退出标志被设置, 且生产缓冲区已无数据, 这时候再退出, 否则有可能会造成生产缓冲区中有数据, 但是没有被完全处理
                     if (_stop && _pro_buf.empty())
@@ -77,33 +257,772 @@ namespace tjq
                     // 若当前是退出前被唤醒, 或者有数据被唤醒, 则返回真, 继续向下运行, 否则重新陷入休眠
                     _cond_con.wait(lock, [&]()
                                    { return _stop || !_pro_buf.empty(); });
+                }
+                // 2. 先获取落地锁再交换缓冲区, 与退化为同步落地的生产者互斥, 保证日志顺序
+                std::unique_lock<std::mutex> sink_lock(_sink_mutex);
+                uint64_t seq = 0, evicted = 0;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
                     _con_buf.swap(_pro_buf);
-                    // 2. 唤醒生产者
-                    if (_looper_type == AsyncType::ASYNC_SAFE)
+                    seq = _pushed;
+                    evicted = _evicted;
+                    _evicted = 0;
+                    _chunks.clear();
+                    // 唤醒生产者
+                    if (_looper_type == AsyncType::ASYNC_SAFE || _looper_type == AsyncType::ASYNC_BLOCK_TIMEOUT)
                     {
                         _cond_pro.notify_all();
                     }
                 }
-                // 3. 被唤醒后, 对消费缓冲区进行数据处理
-                _callBack(_con_buf);
+                // 3. 对消费缓冲区进行数据处理(生产缓冲区可能已被退化落地的生产者取走)
+                size_t bytes = _con_buf.readAbleSize();
+                if (bytes > 0)
+                {
+                    _callBack(_con_buf);
+                }
+                finish(seq, evicted, bytes);
+                sink_lock.unlock();
                 // 4. 初始化消费缓冲区
                 _con_buf.reset();
             }
         }
 
+        // 序号seq之前写入的数据(本批bytes字节)已经处理完毕, 唤醒等待刷新的线程
+        // 本批序号中有evicted条已被DROP_OLDEST策略丢弃, 它们计入丢弃而不计入输出
+        void finish(uint64_t seq, uint64_t evicted, size_t bytes)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (bytes > 0)
+                {
+                    countOut(seq - _done - evicted, bytes);
+                }
+                _done = seq;
+            }
+            _cond_flush.notify_all();
+        }
+
+        // 生产缓冲区能否放下len字节, 缓冲区为空时总是可以放下(单条日志超过缓冲区大小时扩容)
+        bool fits(size_t len)
+        {
+            return _pro_buf.writeAbleSize() >= len || _pro_buf.empty();
+        }
+
+        // 记录日志所在的块: 每个块由若干条完整的日志组成, 大小达到ASYNC_DROP_CHUNK_SIZE后开始新的块
+        void mark(size_t len)
+        {
+            if (_chunks.empty() || _chunks.back()._bytes >= ASYNC_DROP_CHUNK_SIZE)
+            {
+                _chunks.push_back(Chunk{0, 0});
+            }
+            _chunks.back()._bytes += len;
+            _chunks.back()._records++;
+        }
+
+        // 从最早的块开始丢弃, 直到能够放下len字节
+        void dropOldest(size_t len)
+        {
+            size_t bytes = 0;
+            while (_chunks.empty() == false && _pro_buf.writeAbleSize() + bytes < len)
+            {
+                bytes += _chunks.front()._bytes;
+                _evicted += _chunks.front()._records;
+                drop(_chunks.front()._records, _chunks.front()._bytes);
+                _chunks.pop_front();
+            }
+            _pro_buf.moveReader(bytes);
+            _pro_buf.compact();
+        }
+
+        // 缓冲区满了, 生产者线程自己完成落地: 先落地缓冲区中已有的日志, 再落地当前日志
+        void degrade(const char *data, size_t len)
+        {
+            std::unique_lock<std::mutex> sink_lock(_sink_mutex);
+            uint64_t seq = 0, evicted = 0;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                // 等待落地锁期间工作线程可能已经取走了数据
+                countIn(1, len);
+                if (fits(len))
+                {
+                    _pro_buf.push(data, len);
+                    _pushed++;
+                    _cond_con.notify_one();
+                    return;
+                }
+                _sync_buf.swap(_pro_buf);
+                seq = ++_pushed;
+                evicted = _evicted;
+                _evicted = 0;
+            }
+            _sync_buf.push(data, len);
+            size_t bytes = _sync_buf.readAbleSize();
+            _callBack(_sync_buf);
+            _sync_buf.reset();
+            finish(seq, evicted, bytes);
+        }
+
     private:
         Functor _callBack; // 具体对缓冲区数据进行处理的回调函数, 由异步工作器使用者传入
 
     private:
+        struct Chunk
+        {
+            size_t _bytes;
+            size_t _records;
+        };
+
         AsyncType _looper_type;
-        bool _stop;      // 工作器停止标志
-        Buffer _pro_buf; // 生产缓冲区
-        Buffer _con_buf; // 消费缓冲区
+        std::chrono::milliseconds _timeout; // ASYNC_BLOCK_TIMEOUT策略的等待时间
+        bool _stop;                         // 工作器停止标志
+        Buffer _pro_buf;                    // 生产缓冲区
+        Buffer _con_buf;                    // 消费缓冲区
+        Buffer _sync_buf;                   // ASYNC_DEGRADE_SYNC策略下生产者落地使用的缓冲区
+        std::deque<Chunk> _chunks;          // ASYNC_DROP_OLDEST策略下生产缓冲区中日志块的划分
+        std::mutex _sink_mutex;             // 落地锁: 工作线程与退化为同步落地的生产者互斥
+        uint64_t _pushed = 0;               // 写入生产缓冲区的日志序号
+        uint64_t _done = 0;                 // 已经处理完毕的日志序号
+        uint64_t _evicted = 0;              // 生产缓冲区中被DROP_OLDEST策略丢弃的日志条数(序号已分配)
         std::mutex _mutex;
         std::condition_variable _cond_pro;
         std::condition_variable _cond_con;
+        std::condition_variable _cond_flush; // 等待刷新的线程
         std::thread _thread; // 异步工作器对应的工作线程
     };
+
+#define RING_SLOT_SIZE 128                  // 环形队列单个槽位的大小
+#define RING_SLOT_COUNT (32 * 1024)         // 环形队列槽位数量(必须是2的整数次幂)
+#define RING_BATCH_SIZE DEFAULT_BUFFER_SIZE // 工作线程单次批量处理的最大数据量
+
+    /*  无锁环形队列工作器(多生产者/单消费者)
+        1. 队列由固定数量, 固定大小的槽位组成, 每个槽位带有一个序号, 用来判断槽位当前是否可写/可读
+        2. 生产者通过CAS移动写位置, 一次预留一条日志所需的连续槽位, 写入数据后发布首槽位
+        3. 工作线程按顺序取出已发布的日志, 拷贝到消费缓冲区中, 攒够一批(或取空)后统一交给回调处理
+        4. 只有在工作线程休眠时, 生产者才会加锁唤醒它, 正常情况下生产过程不加锁
+    */
+    class RingLooper : public Looper
+    {
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> _seq; // 槽位序号: 等于位置表示可写, 等于位置+1表示可读
+            uint32_t _len;            // 日志数据总长度(仅首槽位有效)
+            uint32_t _count;          // 日志占用的槽位数量(仅首槽位有效)
+            char _data[RING_SLOT_SIZE - sizeof(std::atomic<size_t>) - 2 * sizeof(uint32_t)];
+        };
+        enum
+        {
+            SLOT_DATA_SIZE = sizeof(Slot::_data) // 单个槽位可以存放的数据大小
+        };
+
+    public:
+        using ptr = std::shared_ptr<RingLooper>;
+        RingLooper(const Functor &cb)
+            : _callBack(cb),
+              _capacity(RING_SLOT_COUNT),
+              _mask(RING_SLOT_COUNT - 1),
+              _slots(new Slot[RING_SLOT_COUNT]),
+              _tail(0),
+              _head(0),
+              _done(0),
+              _stop(false),
+              _sleeping(false)
+        {
+            static_assert((RING_SLOT_COUNT & (RING_SLOT_COUNT - 1)) == 0, "RING_SLOT_COUNT必须是2的整数次幂");
+            for (size_t i = 0; i < _capacity; i++)
+            {
+                _slots[i]._seq.store(i, std::memory_order_relaxed);
+            }
+            _thread = std::thread(&RingLooper::threadEntry, this);
+        }
+        ~RingLooper()
+        {
+            stop();
+        }
+
+        void stop() override
+        {
+            if (_thread.joinable() == false)
+            {
+                return;
+            }
+            _stop.store(true);
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond_con.notify_all();
+            }
+            _thread.join();
+        }
+
+        // 无锁工作器的写入量在工作线程取出时统计, 队列深度按已预留未处理的槽位估算
+        LooperStats stats() override
+        {
+            LooperStats st = Looper::stats();
+            size_t tail = _tail.load(std::memory_order_relaxed), done = _done.load(std::memory_order_relaxed);
+            st._pending_bytes = tail > done ? (tail - done) * SLOT_DATA_SIZE : 0;
+            return st;
+        }
+
+        // 已经预留的槽位都处理完毕才返回, 每隔1毫秒检查一次
+        void flush() override
+        {
+            size_t target = _tail.load(std::memory_order_relaxed);
+            while (_done.load(std::memory_order_acquire) < target && _stop.load() == false)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond_con.notify_all();
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        void push(const char *data, size_t len) override
+        {
+            // 环形队列大小固定, 超过整个队列容量的日志只能截断
+            if (len > _capacity * SLOT_DATA_SIZE)
+            {
+                len = _capacity * SLOT_DATA_SIZE;
+            }
+            size_t count = len == 0 ? 1 : (len + SLOT_DATA_SIZE - 1) / SLOT_DATA_SIZE;
+            // 1. 预留连续的count个槽位: 工作线程按顺序释放槽位, 因此最后一个槽位可写, 说明前面的槽位都可写
+            size_t pos = _tail.load(std::memory_order_relaxed);
+            uint64_t wait_start = 0;
+            while (true)
+            {
+                Slot &last = _slots[(pos + count - 1) & _mask];
+                size_t seq = last._seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + count - 1);
+                if (diff == 0)
+                {
+                    if (_tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // 队列已满, 让出CPU等待工作线程释放槽位
+                    wait_start = wait_start == 0 ? statsClock() : wait_start;
+                    std::this_thread::yield();
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+                else
+                {
+                    // 槽位已经被其它生产者预留, 重新获取写位置
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+            if (wait_start != 0)
+            {
+                countWait(statsClock() - wait_start);
+            }
+            // 2. 将数据拷贝到预留的槽位中
+            Slot &first = _slots[pos & _mask];
+            first._len = (uint32_t)len;
+            first._count = (uint32_t)count;
+            for (size_t i = 0, off = 0; i < count; i++, off += SLOT_DATA_SIZE)
+            {
+                size_t n = len - off < SLOT_DATA_SIZE ? len - off : SLOT_DATA_SIZE;
+                memcpy(_slots[(pos + i) & _mask]._data, data + off, n);
+            }
+            // 3. 发布首槽位, 工作线程看到首槽位可读, 就说明整条日志都已经写入完毕
+            first._seq.store(pos + 1, std::memory_order_release);
+            // 4. 工作线程处于休眠状态才需要唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond_con.notify_one();
+            }
+        }
+
+    private:
+        // 判断队头是否有已发布的日志
+        bool readAble()
+        {
+            return _slots[_head & _mask]._seq.load(std::memory_order_acquire) == _head + 1;
+        }
+
+        // 从队列中批量取出已发布的日志到消费缓冲区, 返回取出的日志条数
+        size_t drain()
+        {
+            size_t records = 0;
+            while (_con_buf.readAbleSize() < RING_BATCH_SIZE && readAble())
+            {
+                Slot &first = _slots[_head & _mask];
+                size_t len = first._len, count = first._count;
+                for (size_t i = 0, off = 0; i < count; i++, off += SLOT_DATA_SIZE)
+                {
+                    size_t n = len - off < SLOT_DATA_SIZE ? len - off : SLOT_DATA_SIZE;
+                    _con_buf.push(_slots[(_head + i) & _mask]._data, n);
+                }
+                // 按顺序释放槽位, 槽位序号推进一圈, 供下一轮的生产者使用
+                for (size_t i = 0; i < count; i++)
+                {
+                    _slots[(_head + i) & _mask]._seq.store(_head + i + _capacity, std::memory_order_release);
+                }
+                _head += count;
+                records++;
+            }
+            return records;
+        }
+
+        void threadEntry()
+        {
+            while (true)
+            {
+                // 1. 批量取出数据, 取出之后槽位就已经释放, 生产者可以继续写入
+                size_t records = drain();
+                if (records > 0)
+                {
+                    // 2. 对消费缓冲区进行数据处理, 然后初始化消费缓冲区
+                    size_t bytes = _con_buf.readAbleSize();
+                    countIn(records, bytes);
+                    _callBack(_con_buf);
+                    _con_buf.reset();
+                    _done.store(_head, std::memory_order_release);
+                    countOut(records, bytes);
+                    continue;
+                }
+                // 3. 队列为空: 退出标志被设置则退出, 否则陷入休眠等待生产者唤醒
+                if (_stop.load())
+                {
+                    break;
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                _sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (readAble() == false && _stop.load() == false)
+                {
+                    // 设置超时时间作为兜底, 避免极端情况下错过唤醒
+                    _cond_con.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                _sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        Functor _callBack;
+        size_t _capacity;
+        size_t _mask;
+        std::unique_ptr<Slot[]> _slots;
+        char _pad0[64];             // 避免生产者与消费者的位置变量处于同一缓存行(伪共享)
+        std::atomic<size_t> _tail;  // 生产者预留位置
+        char _pad1[64];
+        size_t _head;               // 消费者读取位置(只有工作线程访问)
+        std::atomic<size_t> _done;  // 已经处理完毕的位置
+        Buffer _con_buf;            // 消费缓冲区
+        std::atomic<bool> _stop;
+        std::atomic<bool> _sleeping; // 工作线程是否处于休眠状态
+        std::mutex _mutex;
+        std::condition_variable _cond_con;
+        std::thread _thread;
+    };
+
+#define STAGING_BUFFER_SIZE (256 * 1024) // 单个线程暂存区的大小(必须是2的整数次幂)
+#define STAGING_FLUSH_INTERVAL 1         // 有数据时工作线程收集暂存区的周期(毫秒)
+
+    /*  线程暂存区: 单生产者/单消费者的无锁环形字节缓冲区
+        1. 生产者(所属线程)写入 [时间戳 + 长度 + 数据], 只修改写位置
+        2. 消费者(工作线程)读取数据, 只修改读位置
+        3. 剩余尾部空间放不下一整条日志时, 写入回绕标记, 从缓冲区开头继续写入
+    */
+    class StagingBuffer
+    {
+    public:
+        struct Header
+        {
+            uint64_t _stamp; // 日志写入时间戳(单调时钟, 纳秒)
+            uint32_t _len;   // 日志数据长度, WRAP表示回绕标记
+            uint32_t _reserve;
+        };
+        enum
+        {
+            ALIGN = sizeof(Header), // 日志按头部大小对齐, 保证尾部剩余空间总能放下回绕标记
+            WRAP = 0xFFFFFFFF
+        };
+        using ptr = std::shared_ptr<StagingBuffer>;
+        StagingBuffer(size_t capacity = STAGING_BUFFER_SIZE)
+            : _buffer(new char[capacity]),
+              _capacity(capacity),
+              _head_cache(0),
+              _head(0),
+              _tail(0),
+              _closed(false)
+        {
+            static_assert((STAGING_BUFFER_SIZE & (STAGING_BUFFER_SIZE - 1)) == 0, "STAGING_BUFFER_SIZE必须是2的整数次幂");
+        }
+
+        // 单条日志允许的最大长度, 超过则截断
+        size_t maxRecordSize()
+        {
+            return _capacity / 2 - sizeof(Header);
+        }
+
+        // 生产者: 写入一条日志, 剩余空间不足则返回false
+        bool push(uint64_t stamp, const char *data, size_t len)
+        {
+            size_t need = sizeof(Header) + (len + ALIGN - 1) / ALIGN * ALIGN;
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t off = tail & (_capacity - 1);
+            size_t pad = off + need > _capacity ? _capacity - off : 0;
+            if (tail + pad + need - _head_cache > _capacity)
+            {
+                _head_cache = _head.load(std::memory_order_acquire);
+                if (tail + pad + need - _head_cache > _capacity)
+                {
+                    return false;
+                }
+            }
+            if (pad > 0)
+            {
+                Header *wrap = (Header *)(_buffer.get() + off);
+                wrap->_len = WRAP;
+                off = 0;
+            }
+            Header *hdr = (Header *)(_buffer.get() + off);
+            hdr->_stamp = stamp;
+            hdr->_len = (uint32_t)len;
+            memcpy(_buffer.get() + off + sizeof(Header), data, len);
+            _tail.store(tail + pad + need, std::memory_order_release);
+            return true;
+        }
+
+        // 生产者: 判断暂存区是否已经使用过半(需要提醒工作线程尽快收集)
+        bool halfFull()
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head_cache <= _capacity / 2)
+            {
+                return false;
+            }
+            _head_cache = _head.load(std::memory_order_acquire);
+            return tail - _head_cache > _capacity / 2;
+        }
+
+        // 消费者: 获取当前读位置和已发布数据的结束位置
+        size_t readPos()
+        {
+            return _head.load(std::memory_order_relaxed);
+        }
+        size_t readEnd()
+        {
+            return _tail.load(std::memory_order_acquire);
+        }
+
+        // 消费者: 获取pos位置的日志(跳过回绕标记), 没有可读日志返回nullptr
+        const Header *peek(size_t &pos, size_t end)
+        {
+            while (pos < end)
+            {
+                const Header *hdr = (const Header *)(_buffer.get() + (pos & (_capacity - 1)));
+                if (hdr->_len != WRAP)
+                {
+                    return hdr;
+                }
+                pos += _capacity - (pos & (_capacity - 1));
+            }
+            return nullptr;
+        }
+
+        // 消费者: 计算下一条日志的位置
+        size_t next(size_t pos, const Header *hdr)
+        {
+            return pos + sizeof(Header) + (hdr->_len + ALIGN - 1) / ALIGN * ALIGN;
+        }
+
+        // 消费者: 释放pos之前的空间
+        void release(size_t pos)
+        {
+            _head.store(pos, std::memory_order_release);
+        }
+
+        // 所属线程退出时关闭暂存区, 工作线程处理完剩余数据后将其移除
+        void close()
+        {
+            _closed.store(true, std::memory_order_release);
+        }
+        bool closed()
+        {
+            return _closed.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::unique_ptr<char[]> _buffer;
+        size_t _capacity;
+        size_t _head_cache; // 生产者缓存的读位置, 减少对_head所在缓存行的访问
+        char _pad0[64];
+        std::atomic<size_t> _head; // 读位置(工作线程修改)
+        char _pad1[64];
+        std::atomic<size_t> _tail; // 写位置(生产者修改)
+        std::atomic<bool> _closed;
+    };
+
+    /*  线程暂存区工作器
+        1. 生产线程第一次写入时注册一个属于自己的暂存区, 之后的写入完全不需要同步
+        2. 工作线程定期(或在某个暂存区使用过半时被唤醒)收集所有暂存区中的数据
+        3. 每个暂存区内部的日志本身有序, 工作线程按时间戳对所有暂存区进行多路归并后交给回调处理
+           (只保证同一轮收集内的日志按时间戳有序, 不同轮之间按收集的先后输出)
+        4. 暂存区归工作器所有, 线程中只保存弱引用: 工作器销毁时暂存区随之释放, 不会滞留在生产线程中
+    */
+    class StagingLooper : public Looper
+    {
+    public:
+        using ptr = std::shared_ptr<StagingLooper>;
+        StagingLooper(const Functor &cb)
+            : _callBack(cb),
+              _id(nextId()),
+              _stop(false),
+              _sleeping(false)
+        {
+            _thread = std::thread(&StagingLooper::threadEntry, this);
+        }
+        ~StagingLooper()
+        {
+            stop();
+        }
+
+        void stop() override
+        {
+            if (_thread.joinable() == false)
+            {
+                return;
+            }
+            _stop.store(true);
+            wakeUp();
+            _thread.join();
+        }
+
+        // 调用之后开始的一轮收集完成时, 之前写入暂存区的数据都已处理完毕, 每隔1毫秒检查一次
+        void flush() override
+        {
+            uint64_t target = _rounds.load(std::memory_order_acquire) + 2;
+            while (_rounds.load(std::memory_order_acquire) < target && _stop.load() == false)
+            {
+                wakeUp();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        void push(const char *data, size_t len) override
+        {
+            uint64_t stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch())
+                                 .count();
+            push(stamp, data, len);
+        }
+        // 使用调用者提供的时间戳进行归并(同一个工作器的所有写入必须使用相同的时钟)
+        void push(uint64_t stamp, const char *data, size_t len)
+        {
+            StagingBuffer *buf = localBuffer();
+            if (len > buf->maxRecordSize())
+            {
+                len = buf->maxRecordSize();
+            }
+            // 暂存区满了则唤醒工作线程, 等待工作线程收集后再写入
+            if (buf->push(stamp, data, len) == false)
+            {
+                uint64_t start = statsClock();
+                do
+                {
+                    wakeUp();
+                    std::this_thread::yield();
+                } while (buf->push(stamp, data, len) == false);
+                countWait(statsClock() - start);
+            }
+            // 暂存区使用过半, 或工作线程处于休眠状态, 则唤醒工作线程
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed) || buf->halfFull())
+            {
+                wakeUp();
+            }
+        }
+
+    private:
+        static size_t nextId()
+        {
+            static std::atomic<size_t> id(0);
+            return ++id;
+        }
+
+        void wakeUp()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond_con.notify_one();
+        }
+
+        // 获取当前线程在本工作器中的暂存区, 第一次使用时创建并注册
+        // 工作器存活期间暂存区只会在所属线程退出后被移除, 因此查找时可以直接使用裸指针
+        StagingBuffer *localBuffer()
+        {
+            struct LocalEntry
+            {
+                size_t _id;
+                StagingBuffer *_raw;
+                std::weak_ptr<StagingBuffer> _buf;
+            };
+            struct LocalBuffers
+            {
+                std::vector<LocalEntry> _entries;
+                ~LocalBuffers()
+                {
+                    for (auto &entry : _entries)
+                    {
+                        StagingBuffer::ptr buf = entry._buf.lock();
+                        if (buf)
+                        {
+                            buf->close();
+                        }
+                    }
+                }
+            };
+            static thread_local LocalBuffers local;
+            for (auto &entry : local._entries)
+            {
+                if (entry._id == _id)
+                {
+                    return entry._raw;
+                }
+            }
+            // 清理已经销毁的工作器遗留的记录
+            for (auto it = local._entries.begin(); it != local._entries.end();)
+            {
+                it = it->_buf.expired() ? local._entries.erase(it) : it + 1;
+            }
+            StagingBuffer::ptr buf = std::make_shared<StagingBuffer>();
+            local._entries.push_back(LocalEntry{_id, buf.get(), buf});
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.push_back(buf);
+            return buf.get();
+        }
+
+        // 收集所有暂存区中的数据, 按时间戳归并到消费缓冲区中, 返回收集到的日志条数
+        size_t collect()
+        {
+            // 1. 将新注册的暂存区加入工作线程持有的列表
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _buffers.insert(_buffers.end(), _pending.begin(), _pending.end());
+                _pending.clear();
+            }
+            // 2. 确定本轮每个暂存区的可读范围, 并将各个暂存区的第一条日志加入小根堆
+            struct Cursor
+            {
+                size_t _pos;
+                size_t _end;
+                bool _closed;
+            };
+            std::vector<Cursor> cursors(_buffers.size());
+            using Item = std::pair<uint64_t, size_t>; // <时间戳, 暂存区下标>
+            std::priority_queue<Item, std::vector<Item>, std::greater<Item>> heap;
+            for (size_t i = 0; i < _buffers.size(); i++)
+            {
+                cursors[i]._closed = _buffers[i]->closed(); // 先判断关闭, 再获取结束位置, 保证关闭前写入的数据都能被看到
+                cursors[i]._pos = _buffers[i]->readPos();
+                cursors[i]._end = _buffers[i]->readEnd();
+                const StagingBuffer::Header *hdr = _buffers[i]->peek(cursors[i]._pos, cursors[i]._end);
+                if (hdr != nullptr)
+                {
+                    heap.push(Item(hdr->_stamp, i));
+                }
+            }
+            // 3. 多路归并: 每次取出时间戳最小的日志
+            size_t records = 0;
+            while (heap.empty() == false)
+            {
+                size_t i = heap.top().second;
+                heap.pop();
+                Cursor &cur = cursors[i];
+                const StagingBuffer::Header *hdr = _buffers[i]->peek(cur._pos, cur._end);
+                _con_buf.push((const char *)(hdr + 1), hdr->_len);
+                cur._pos = _buffers[i]->next(cur._pos, hdr);
+                records++;
+                hdr = _buffers[i]->peek(cur._pos, cur._end);
+                if (hdr != nullptr)
+                {
+                    heap.push(Item(hdr->_stamp, i));
+                }
+            }
+            // 4. 数据已经拷贝到消费缓冲区, 释放暂存区空间, 移除已关闭且没有剩余数据的暂存区
+            size_t idx = 0;
+            for (size_t i = 0; i < _buffers.size(); i++)
+            {
+                _buffers[i]->release(cursors[i]._pos);
+                if (cursors[i]._closed && cursors[i]._pos == cursors[i]._end)
+                {
+                    continue;
+                }
+                _buffers[idx++] = _buffers[i];
+            }
+            _buffers.resize(idx);
+            return records;
+        }
+
+        // 判断是否有暂存区中存在未收集的数据
+        bool readAble()
+        {
+            for (auto &buf : _buffers)
+            {
+                if (buf->readPos() != buf->readEnd())
+                {
+                    return true;
+                }
+            }
+            return _pending.empty() == false;
+        }
+
+        void threadEntry()
+        {
+            while (true)
+            {
+                // 1. 收集并归并暂存区中的数据, 交给回调处理后初始化消费缓冲区
+                size_t records = collect();
+                if (records > 0)
+                {
+                    // 无锁工作器的写入量在工作线程收集时统计(暂存区归各个生产线程所有, 不统计队列深度)
+                    size_t bytes = _con_buf.readAbleSize();
+                    countIn(records, bytes);
+                    _callBack(_con_buf);
+                    _con_buf.reset();
+                    countOut(records, bytes);
+                }
+                _rounds.fetch_add(1, std::memory_order_release);
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (records > 0)
+                {
+                    // 2. 有数据时周期性收集, 生产者只在暂存区使用过半时才唤醒工作线程
+                    _cond_con.wait_for(lock, std::chrono::milliseconds(STAGING_FLUSH_INTERVAL));
+                    continue;
+                }
+                // 3. 暂存区都为空: 退出标志被设置则退出, 否则陷入休眠等待生产者唤醒
+                if (_stop.load())
+                {
+                    break;
+                }
+                _sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (readAble() == false && _stop.load() == false)
+                {
+                    _cond_con.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                _sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        Functor _callBack;
+        size_t _id; // 工作器编号, 用于区分线程在不同工作器中的暂存区
+        Buffer _con_buf;
+        std::vector<StagingBuffer::ptr> _buffers; // 工作线程正在收集的暂存区
+        std::vector<StagingBuffer::ptr> _pending; // 新注册, 还未被工作线程接管的暂存区
+        std::atomic<uint64_t> _rounds{0};         // 已经完成的收集轮数
+        std::atomic<bool> _stop;
+        std::atomic<bool> _sleeping;
+        std::mutex _mutex;
+        std::condition_variable _cond_con;
+        std::thread _thread;
+    };
 }
 
 #endif
\ No newline at end of file
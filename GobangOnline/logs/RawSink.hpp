@@ -0,0 +1,514 @@
+#ifndef __M_RAWSINK_H__
+#define __M_RAWSINK_H__
+
+/*  直接基于文件描述符的落地方向(不经过标准库缓冲区)
+    1. log只记录数据所在的位置, 不拷贝数据; 日志器写完一批日志调用flush时统一提交
+    2. 同一个线程中所有原始落地方向(包括滚动切换前的旧文件)的数据在一次提交中完成:
+       每个文件一次writev, 或者所有文件一次io_uring_enter
+    3. io_uring需要在构造落地方向时指定, 内核不支持(或被禁用)时自动退回writev
+    4. 数据在flush之前必须保持有效, 日志器的缓冲区在一批日志落地完毕之前不会被修改
+*/
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "Sink.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define TJQ_HAS_IO_URING 1
+#else
+#define TJQ_HAS_IO_URING 0
+#endif
+
+#define RAW_BATCH_IOV 1024 // 单个文件一批最多积攒的数据块数量(不超过IOV_MAX), 达到后提前提交
+#define URING_ENTRIES 64   // io_uring提交队列大小, 一次提交最多涉及的文件数量
+
+namespace tjq
+{
+    enum class IoMode
+    {
+        IO_WRITEV, // 每个文件一次writev
+        IO_URING   // 所有文件一次io_uring_enter, 内核不支持时退回writev
+    };
+
+    // 原始落地方向发起的系统调用次数与写入的数据量(所有线程累计)
+    class IoStats
+    {
+    public:
+        static std::atomic<uint64_t> &syscalls()
+        {
+            static std::atomic<uint64_t> count(0);
+            return count;
+        }
+        static std::atomic<uint64_t> &bytes()
+        {
+            static std::atomic<uint64_t> count(0);
+            return count;
+        }
+    };
+
+    // 一个打开的日志文件, 以及本批次还未提交的数据块; 对象销毁时写出剩余数据并关闭文件
+    class RawFile
+    {
+    public:
+        using ptr = std::shared_ptr<RawFile>;
+        RawFile(const std::string &pathname, const FlushPolicy &policy)
+            : _policy(policy),
+              _pending(0),
+              _unsynced(0),
+              _last_sync(now())
+        {
+            tool::File::createDirectory(tool::File::path(pathname));
+            _fd = ::open(pathname.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            assert(_fd >= 0);
+        }
+        ~RawFile()
+        {
+            writeAll();
+            if (_policy._type == FlushType::FLUSH_FSYNC)
+            {
+                ::fsync(_fd);
+            }
+            ::close(_fd);
+        }
+
+        int fd()
+        {
+            return _fd;
+        }
+        std::vector<struct iovec> &iov()
+        {
+            return _iov;
+        }
+        size_t pending()
+        {
+            return _pending;
+        }
+
+        // 记录一个数据块, 返回本批次的数据块数量
+        size_t append(const char *data, size_t len)
+        {
+            _iov.push_back(iovec{(void *)data, len});
+            _pending += len;
+            _unsynced += len;
+            return _iov.size();
+        }
+
+        // 已经写出n字节: 丢弃写完的数据块, 剩余数据保留在队列中
+        void consume(size_t n)
+        {
+            IoStats::bytes().fetch_add(n, std::memory_order_relaxed);
+            _pending -= n;
+            size_t idx = 0;
+            while (idx < _iov.size() && n >= _iov[idx].iov_len)
+            {
+                n -= _iov[idx++].iov_len;
+            }
+            if (idx < _iov.size())
+            {
+                _iov[idx].iov_base = (char *)_iov[idx].iov_base + n;
+                _iov[idx].iov_len -= n;
+            }
+            _iov.erase(_iov.begin(), _iov.begin() + idx);
+        }
+
+        // 通过writev写出本批次的全部数据(处理部分写入)
+        void writeAll()
+        {
+            while (_pending > 0)
+            {
+                ssize_t ret = ::writev(_fd, _iov.data(), (int)_iov.size());
+                IoStats::syscalls().fetch_add(1, std::memory_order_relaxed);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    std::cerr << "RawSink.hpp::RawFile::writeAll: writev failed: " << strerror(errno) << std::endl;
+                    IoStats::bytes().fetch_add(_pending, std::memory_order_relaxed);
+                    _iov.clear();
+                    _pending = 0;
+                    return;
+                }
+                consume(ret);
+            }
+            _iov.clear();
+        }
+
+        // 数据提交之后, 按照持久化策略同步(数据已经直接写入内核, FLUSH_BATCH不需要额外操作)
+        void sync(bool force)
+        {
+            if (_policy._type != FlushType::FLUSH_FSYNC || _unsynced == 0)
+            {
+                return;
+            }
+            uint64_t cur = now();
+            if (force || _unsynced >= _policy._bytes || cur - _last_sync >= _policy._interval)
+            {
+                ::fsync(_fd);
+                IoStats::syscalls().fetch_add(1, std::memory_order_relaxed);
+                _unsynced = 0;
+                _last_sync = cur;
+            }
+        }
+
+    private:
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        int _fd;
+        FlushPolicy _policy;
+        std::vector<struct iovec> _iov; // 本批次待提交的数据块
+        size_t _pending;                // 本批次待提交的数据量
+        size_t _unsynced;               // 上次同步之后写入的数据量
+        uint64_t _last_sync;            // 上次同步的时间(毫秒)
+    };
+
+#if TJQ_HAS_IO_URING
+    /*  最小化的io_uring封装(直接使用系统调用, 不依赖liburing)
+        每个文件提交一个WRITEV请求, 写入文件当前位置(需要内核支持IORING_FEAT_RW_CUR_POS, 5.6及以上)
+        同一个文件的数据在一个请求中, 不同文件的请求之间没有顺序要求
+    */
+    class Uring
+    {
+    public:
+        Uring()
+            : _fd(-1)
+        {
+        }
+        ~Uring()
+        {
+            if (_fd < 0)
+            {
+                return;
+            }
+            munmap(_sqes, _sqes_len);
+            if (_cq_ptr != _sq_ptr)
+            {
+                munmap(_cq_ptr, _cq_len);
+            }
+            munmap(_sq_ptr, _sq_len);
+            ::close(_fd);
+        }
+
+        bool init()
+        {
+            struct io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            _fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+            if (_fd < 0)
+            {
+                return false;
+            }
+            if ((p.features & IORING_FEAT_RW_CUR_POS) == 0)
+            {
+                ::close(_fd);
+                _fd = -1;
+                return false;
+            }
+            _sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            _cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                _sq_len = _cq_len = std::max(_sq_len, _cq_len);
+            }
+            _sq_ptr = mmap(nullptr, _sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            _cq_ptr = _sq_ptr;
+            if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0 && _sq_ptr != MAP_FAILED)
+            {
+                _cq_ptr = mmap(nullptr, _cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+            }
+            _sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+            _sqes = (struct io_uring_sqe *)mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+            if (_sq_ptr == MAP_FAILED || _cq_ptr == MAP_FAILED || _sqes == MAP_FAILED)
+            {
+                std::cerr << "RawSink.hpp::Uring::init: mmap failed!" << std::endl;
+                ::close(_fd);
+                _fd = -1;
+                return false;
+            }
+            char *sq = (char *)_sq_ptr, *cq = (char *)_cq_ptr;
+            _sq_tail = (unsigned *)(sq + p.sq_off.tail);
+            _sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+            _sq_array = (unsigned *)(sq + p.sq_off.array);
+            _cq_head = (unsigned *)(cq + p.cq_off.head);
+            _cq_tail = (unsigned *)(cq + p.cq_off.tail);
+            _cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+            _cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+            return true;
+        }
+
+        // 提交files中每个文件的数据并等待全部完成, 返回false表示提交失败(数据保持不变, 由调用者退回writev)
+        bool submit(std::vector<RawFile::ptr> &files, size_t begin, size_t count)
+        {
+            // 1. 填充请求: 提交是同步的, 提交队列在每次调用开始时总是空的
+            unsigned tail = *_sq_tail;
+            for (size_t i = 0; i < count; i++)
+            {
+                RawFile::ptr &file = files[begin + i];
+                unsigned idx = (tail + i) & _sq_mask;
+                struct io_uring_sqe *sqe = &_sqes[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_WRITEV;
+                sqe->fd = file->fd();
+                sqe->off = (uint64_t)-1; // 写入文件当前位置
+                sqe->addr = (uint64_t)(uintptr_t)file->iov().data();
+                sqe->len = (unsigned)file->iov().size();
+                sqe->user_data = begin + i;
+                _sq_array[idx] = idx;
+            }
+            __atomic_store_n(_sq_tail, tail + (unsigned)count, __ATOMIC_RELEASE);
+            // 2. 一次系统调用完成提交并等待全部请求完成
+            int ret = 0;
+            do
+            {
+                ret = (int)syscall(__NR_io_uring_enter, _fd, (unsigned)count, (unsigned)count, IORING_ENTER_GETEVENTS, nullptr, 0);
+            } while (ret < 0 && errno == EINTR);
+            IoStats::syscalls().fetch_add(1, std::memory_order_relaxed);
+            if (ret < 0)
+            {
+                // 请求没有被内核取走, 撤回
+                __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+                return false;
+            }
+            // 3. 收割完成事件: 出错或部分写入的数据保留在文件的队列中, 由调用者通过writev补写
+            size_t reaped = 0;
+            while (reaped < (size_t)ret)
+            {
+                unsigned head = *_cq_head;
+                if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+                {
+                    syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    continue;
+                }
+                struct io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+                if (cqe->res > 0)
+                {
+                    files[cqe->user_data]->consume((size_t)cqe->res);
+                }
+                __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+                reaped++;
+            }
+            return true;
+        }
+
+    private:
+        int _fd;
+        void *_sq_ptr;
+        void *_cq_ptr;
+        size_t _sq_len;
+        size_t _cq_len;
+        size_t _sqes_len;
+        struct io_uring_sqe *_sqes;
+        unsigned *_sq_tail;
+        unsigned _sq_mask;
+        unsigned *_sq_array;
+        unsigned *_cq_head;
+        unsigned *_cq_tail;
+        unsigned _cq_mask;
+        struct io_uring_cqe *_cqes;
+    };
+#endif
+
+    /*  线程局部的提交批次: 记录本线程中有待提交数据的文件, 提交时一次性写出
+        文件对象由批次共同持有, 落地方向在批次提交前滚动切换文件也不会丢失数据
+    */
+    class IoBatch
+    {
+    public:
+        static IoBatch &local()
+        {
+            static thread_local IoBatch batch;
+            return batch;
+        }
+
+        void add(const RawFile::ptr &file, IoMode mode)
+        {
+            _files.push_back(file);
+            _uring = _uring || mode == IoMode::IO_URING;
+        }
+
+        void submit()
+        {
+            if (_files.empty())
+            {
+                return;
+            }
+#if TJQ_HAS_IO_URING
+            if (_uring && ring() != nullptr)
+            {
+                for (size_t begin = 0; begin < _files.size(); begin += URING_ENTRIES)
+                {
+                    size_t count = std::min(_files.size() - begin, (size_t)URING_ENTRIES);
+                    ring()->submit(_files, begin, count);
+                }
+            }
+#endif
+            // writev模式, 或者io_uring失败/部分写入后剩余的数据
+            for (auto &file : _files)
+            {
+                file->writeAll();
+            }
+            _files.clear();
+            _uring = false;
+        }
+
+    private:
+        IoBatch()
+            : _uring(false)
+        {
+        }
+
+#if TJQ_HAS_IO_URING
+        // 第一次使用时创建本线程的io_uring, 内核不支持则之后所有线程都不再尝试
+        Uring *ring()
+        {
+            static std::atomic<bool> unsupported(false);
+            if (_ring.get() == nullptr && unsupported.load(std::memory_order_relaxed) == false)
+            {
+                std::unique_ptr<Uring> ring(new Uring());
+                if (ring->init())
+                {
+                    _ring = std::move(ring);
+                }
+                else
+                {
+                    unsupported.store(true, std::memory_order_relaxed);
+                }
+            }
+            return _ring.get();
+        }
+        std::unique_ptr<Uring> _ring;
+#endif
+
+    private:
+        std::vector<RawFile::ptr> _files;
+        bool _uring; // 本批次是否有落地方向要求使用io_uring
+    };
+
+    // 原始落地方向基类: 数据块加入本线程的提交批次, flush时提交
+    class RawSink : public LogSink
+    {
+    public:
+        RawSink(const FlushPolicy &policy, IoMode mode)
+            : _policy(policy),
+              _mode(mode)
+        {
+        }
+        void log(const char *data, size_t len) override
+        {
+            if (len == 0)
+            {
+                return;
+            }
+            IoBatch &batch = IoBatch::local();
+            if (_file->iov().empty())
+            {
+                batch.add(_file, _mode);
+            }
+            if (_file->append(data, len) >= RAW_BATCH_IOV)
+            {
+                batch.submit();
+            }
+        }
+        void flush(bool force) override
+        {
+            IoBatch::local().submit();
+            _file->sync(force);
+        }
+
+    protected:
+        // 打开新文件, 旧文件在本批次提交之后关闭
+        void open(const std::string &pathname)
+        {
+            _file = std::make_shared<RawFile>(pathname, _policy);
+        }
+
+    protected:
+        FlushPolicy _policy;
+        IoMode _mode;
+        RawFile::ptr _file;
+    };
+
+    /*  落地方向: 指定文件(直接写文件描述符)
+        RawFileSink(const std::string &pathname, const FlushPolicy &policy, IoMode mode);
+        pathname: 文件名
+        policy: 持久化策略(数据在每批日志结束时直接提交给内核, FLUSH_NONE与FLUSH_BATCH相同)
+        mode: 提交方式(默认writev)
+    */
+    class RawFileSink : public RawSink
+    {
+    public:
+        RawFileSink(const std::string &pathname, const FlushPolicy &policy = FlushPolicy(), IoMode mode = IoMode::IO_WRITEV)
+            : RawSink(policy, mode),
+              _pathname(pathname)
+        {
+            open(_pathname);
+        }
+        // 分片写入 pathname.index
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<RawFileSink>(_pathname + "." + std::to_string(index), _policy, _mode);
+        }
+
+    private:
+        std::string _pathname;
+    };
+
+    /*  落地方向: 滚动文件(以大小进行滚动, 直接写文件描述符, 文件名与RollBySizeSink相同)
+        RawRollBySizeSink(const std::string &basename, size_t max_size, const FlushPolicy &policy, IoMode mode);
+    */
+    class RawRollBySizeSink : public RawSink
+    {
+    public:
+        RawRollBySizeSink(const std::string &basename, size_t max_size, const FlushPolicy &policy = FlushPolicy(), IoMode mode = IoMode::IO_WRITEV)
+            : RawSink(policy, mode),
+              _basename(basename),
+              _max_fsize(max_size),
+              _cur_fsize(0),
+              _name_count(0)
+        {
+            open(RollBySizeSink::fileName(_basename, _name_count++));
+        }
+        // 写入前判断文件大小, 超过了最大大小就切换文件, 旧文件中未提交的数据与新文件在同一批次中提交
+        void log(const char *data, size_t len) override
+        {
+            if (_cur_fsize >= _max_fsize)
+            {
+                open(RollBySizeSink::fileName(_basename, _name_count++));
+                _cur_fsize = 0;
+            }
+            RawSink::log(data, len);
+            _cur_fsize += len;
+        }
+        // 分片以 basename + index + "-" 作为基础文件名
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<RawRollBySizeSink>(_basename + std::to_string(index) + "-", _max_fsize, _policy, _mode);
+        }
+
+    private:
+        std::string _basename;
+        size_t _max_fsize;
+        size_t _cur_fsize;
+        size_t _name_count;
+    };
+}
+
+#endif
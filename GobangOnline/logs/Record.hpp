@@ -0,0 +1,692 @@
+#ifndef __M_RECORD_H__
+#define __M_RECORD_H__
+
+/*  日志记录的二进制编码(延迟格式化)
+    1. 生产者只拷贝 [记录头 + 格式化字符串 + 原始参数] 到异步缓冲区中, 不进行任何格式化
+    2. 工作线程解码记录, 按照格式化字符串逐个还原参数进行格式化, 得到与vsnprintf完全一致的日志消息
+    3. 格式化字符串中存在无法延迟处理的转换说明(%n, %m, 位置参数, 宽字符等)时, 生产者直接格式化, 记录为文本类型
+    4. 结构化字段块(见Fields.hpp)按8字节对齐存放在记录末尾, 长度记录在记录头中
+    5. 需要时生产者计算负载的摘要填入记录头, 工作线程只比较摘要即可判断相邻的两条记录是否重复
+*/
+
+#include <thread>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <climits>
+#include <sys/types.h>
+#include <string_view>
+#include "Tool.hpp"
+#include "Level.hpp"
+#include "Site.hpp"
+#include "Buffer.hpp"
+
+namespace tjq
+{
+    enum class RecordKind : uint8_t
+    {
+        TEXT, // 负载为已经组织好的日志消息字符串
+        ARGS  // 负载为格式化字符串 + 原始参数
+    };
+
+    // 记录头: 调用点(源码文件名 + 行号)只记录调用点描述对象的指针, 调用点对象是静态的
+    struct RecordHeader
+    {
+        uint32_t _size;        // 整条记录的长度(按8字节对齐)
+        RecordKind _kind;      // 记录类型
+        uint8_t _level;        // 日志等级
+        uint16_t _fields;      // 记录末尾结构化字段块的长度
+        uint32_t _len;         // TEXT: 消息长度; ARGS: 格式化字符串长度
+        uint32_t _hash;        // 负载的摘要(由digest计算, 否则为0; 占用原有的对齐空间)
+        uint64_t _stamp;       // 日志产生的时间(纳秒)
+        const CallSite *_site; // 调用点
+        std::thread::id _tid;  // 线程ID
+    };
+
+    class Record
+    {
+    public:
+        // 生产者: 将一条日志编码到缓冲区末尾
+        static void encode(Buffer &out, LogLevel::value level, const CallSite &site, const char *fmt, size_t fmt_len, va_list ap)
+        {
+            size_t start = out.readAbleSize();
+            RecordHeader hdr = header(level, site);
+            hdr._kind = RecordKind::ARGS;
+            hdr._len = (uint32_t)fmt_len;
+            out.push((const char *)&hdr, sizeof(hdr));
+            // 1. 拷贝格式化字符串, 按照转换说明依次取出参数进行拷贝
+            out.push(fmt, fmt_len);
+            pad(out);
+            ArgList args;
+            va_copy(args._ap, ap);
+            bool ret = encodeArgs(out, fmt, fmt_len, args);
+            va_end(args._ap);
+            // 2. 存在无法延迟处理的转换说明, 回退为直接组织日志消息字符串
+            if (ret == false)
+            {
+                out.truncate(start + sizeof(hdr));
+                char *res = out.reserve(FORMAT_SIZE);
+                va_list cp;
+                va_copy(cp, ap);
+                int len = vsnprintf(res, out.writeAbleSize(), fmt, cp);
+                va_end(cp);
+                if (len >= 0 && (size_t)len >= out.writeAbleSize())
+                {
+                    res = out.reserve(len + 1);
+                    len = vsnprintf(res, out.writeAbleSize(), fmt, ap);
+                }
+                len = len < 0 ? 0 : len;
+                out.moveWriter(len);
+                pad(out);
+                hdr._kind = RecordKind::TEXT;
+                hdr._len = (uint32_t)len;
+            }
+            // 3. 回填记录长度
+            hdr._size = (uint32_t)(out.readAbleSize() - start);
+            memcpy(out.data() + start, &hdr, sizeof(hdr));
+        }
+
+        // 生产者: 将已经组织好的日志消息编码为文本类型的记录, fields为结构化字段块(不超过FIELDS_MAX_SIZE)
+        static void encodeText(Buffer &out, LogLevel::value level, const CallSite &site, const char *data, size_t len,
+                               std::string_view fields = std::string_view())
+        {
+            RecordHeader hdr = header(level, site);
+            hdr._kind = RecordKind::TEXT;
+            hdr._len = (uint32_t)len;
+            hdr._fields = (uint16_t)fields.size();
+            hdr._size = (uint32_t)(sizeof(hdr) + align(len) + align(fields.size()));
+            out.push((const char *)&hdr, sizeof(hdr));
+            out.push(data, len);
+            pad(out);
+            out.push(fields.data(), fields.size());
+            pad(out);
+        }
+
+        // 生产者: 计算缓冲区中从start开始的一条记录的负载摘要, 回填到记录头
+        // 负载按8字节对齐且填充字节为0, 内容相同的记录摘要一定相同
+        static void digest(Buffer &out, size_t start = 0)
+        {
+            RecordHeader hdr;
+            memcpy(&hdr, out.begin() + start, sizeof(hdr));
+            const char *ptr = out.begin() + start + sizeof(hdr), *end = out.begin() + start + hdr._size;
+            uint64_t hash = 0xcbf29ce484222325ULL ^ hdr._size;
+            for (; ptr + 8 <= end; ptr += 8)
+            {
+                uint64_t word;
+                memcpy(&word, ptr, 8);
+                hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+                hash ^= hash >> 29;
+            }
+            hdr._hash = (uint32_t)(hash ^ (hash >> 32));
+            memcpy(out.data() + start + offsetof(RecordHeader, _hash), &hdr._hash, sizeof(hdr._hash));
+        }
+
+        // 工作线程: 从[ptr, end)中取出一条记录, body指向记录头之后的负载
+        static bool next(const char *&ptr, const char *end, RecordHeader &hdr, const char *&body)
+        {
+            if ((size_t)(end - ptr) < sizeof(RecordHeader))
+            {
+                return false;
+            }
+            memcpy(&hdr, ptr, sizeof(hdr));
+            body = ptr + sizeof(hdr);
+            ptr += hdr._size;
+            return true;
+        }
+
+        // 工作线程: 还原日志消息字符串, ARGS类型的记录格式化到out中
+        static std::string_view payload(Buffer &out, const RecordHeader &hdr, const char *body)
+        {
+            if (hdr._kind == RecordKind::TEXT)
+            {
+                return std::string_view(body, hdr._len);
+            }
+            size_t start = out.readAbleSize();
+            ArgReader reader(args(hdr, body));
+            render(out, body, hdr._len, reader);
+            return std::string_view(out.begin() + start, out.readAbleSize() - start);
+        }
+
+        // 记录末尾的结构化字段块
+        static std::string_view fields(const RecordHeader &hdr, const char *body)
+        {
+            const char *end = body - sizeof(RecordHeader) + hdr._size;
+            return std::string_view(end - align(hdr._fields), hdr._fields);
+        }
+
+        // ARGS类型的记录中原始参数的起始位置
+        static const char *args(const RecordHeader &hdr, const char *body)
+        {
+            return body + align(hdr._len);
+        }
+
+        // 格式化字符串中的转换说明是否都支持延迟处理
+        static bool check(const char *fmt, size_t len)
+        {
+            for (size_t pos = 0; pos < len; pos++)
+            {
+                if (fmt[pos] != '%')
+                {
+                    continue;
+                }
+                if (pos + 1 < len && fmt[pos + 1] == '%')
+                {
+                    pos++;
+                    continue;
+                }
+                Spec spec;
+                if (parseSpec(fmt, len, pos + 1, spec) == false)
+                {
+                    return false;
+                }
+                pos = spec._end - 1;
+            }
+            return true;
+        }
+
+        // 读取记录中按8字节对齐存放的原始参数
+        class ArgReader
+        {
+        public:
+            ArgReader(const char *args)
+                : _args(args)
+            {
+            }
+            int64_t getSigned()
+            {
+                return get<int64_t>();
+            }
+            uint64_t getUnsigned()
+            {
+                return get<uint64_t>();
+            }
+            double getDouble()
+            {
+                return get<double>();
+            }
+            long double getLongDouble()
+            {
+                return get<long double>();
+            }
+            void *getPointer()
+            {
+                return get<void *>();
+            }
+            // 空指针返回nullptr
+            const char *getString()
+            {
+                uint64_t len = get<uint64_t>();
+                if (len == UINT64_MAX)
+                {
+                    return nullptr;
+                }
+                const char *str = _args;
+                _args += align(len + 1);
+                return str;
+            }
+
+        private:
+            template <typename T>
+            T get()
+            {
+                T val;
+                memcpy(&val, _args, sizeof(T));
+                _args += align(sizeof(T));
+                return val;
+            }
+
+        private:
+            const char *_args;
+        };
+
+    private:
+        enum
+        {
+            FORMAT_SIZE = 256, // 单个转换说明格式化结果的预留空间
+            SPEC_SIZE = 32     // 单个转换说明的最大长度
+        };
+
+        // 长度修饰符
+        enum class Length
+        {
+            NONE,
+            HH,
+            H,
+            L,
+            LL,
+            J,
+            Z,
+            T,
+            LD // 'L', long double
+        };
+
+        // 将va_list包装起来按引用传递, 保证被调函数取出参数后调用方的va_list同步推进
+        struct ArgList
+        {
+            va_list _ap;
+        };
+
+        // 转换说明: [_begin, _end)为"%...conv"在格式化字符串中的范围
+        struct Spec
+        {
+            size_t _begin;
+            size_t _end;
+            char _conv;
+            Length _length;
+            int _stars;     // 宽度/精度中'*'的数量
+            int _precision; // 精度: -1表示未指定, PRECISION_STAR表示由'*'参数给出
+        };
+        enum
+        {
+            PRECISION_STAR = -2
+        };
+
+        static RecordHeader header(LogLevel::value level, const CallSite &site)
+        {
+            RecordHeader hdr;
+            hdr._size = 0;
+            hdr._level = (uint8_t)level;
+            hdr._fields = 0;
+            hdr._hash = 0;
+            hdr._stamp = tool::Clock::now();
+            hdr._site = &site;
+            hdr._tid = std::this_thread::get_id();
+            return hdr;
+        }
+
+        static size_t align(size_t len)
+        {
+            return (len + 7) & ~(size_t)7;
+        }
+
+        static void pad(Buffer &out)
+        {
+            size_t len = align(out.readAbleSize()) - out.readAbleSize();
+            memset(out.reserve(len), 0, len);
+            out.moveWriter(len);
+        }
+
+        // 解析pos('%'之后)开始的转换说明, 不支持延迟处理则返回false
+        static bool parseSpec(const char *fmt, size_t len, size_t pos, Spec &spec)
+        {
+            spec._begin = pos - 1;
+            spec._stars = 0;
+            spec._precision = -1;
+            spec._length = Length::NONE;
+            // 1) 标志
+            while (pos < len && strchr("-+ #0'", fmt[pos]) != nullptr && fmt[pos] != '\0')
+            {
+                pos++;
+            }
+            // 2) 宽度 & 精度, 出现'$'说明是位置参数
+            for (int i = 0; i < 2; i++)
+            {
+                if (i == 1)
+                {
+                    if (pos >= len || fmt[pos] != '.')
+                    {
+                        break;
+                    }
+                    pos++;
+                }
+                if (i == 1)
+                {
+                    spec._precision = 0; // 只有'.'时精度为0
+                }
+                if (pos < len && fmt[pos] == '*')
+                {
+                    spec._stars++;
+                    pos++;
+                    if (i == 1)
+                    {
+                        spec._precision = PRECISION_STAR;
+                    }
+                }
+                while (pos < len && fmt[pos] >= '0' && fmt[pos] <= '9')
+                {
+                    if (i == 1 && spec._precision < INT_MAX / 10)
+                    {
+                        spec._precision = spec._precision * 10 + (fmt[pos] - '0');
+                    }
+                    pos++;
+                }
+                if (pos < len && fmt[pos] == '$')
+                {
+                    return false;
+                }
+            }
+            // 3) 长度修饰符
+            if (pos + 1 < len && fmt[pos] == 'h' && fmt[pos + 1] == 'h')
+                spec._length = Length::HH, pos += 2;
+            else if (pos + 1 < len && fmt[pos] == 'l' && fmt[pos + 1] == 'l')
+                spec._length = Length::LL, pos += 2;
+            else if (pos < len && fmt[pos] == 'h')
+                spec._length = Length::H, pos += 1;
+            else if (pos < len && fmt[pos] == 'l')
+                spec._length = Length::L, pos += 1;
+            else if (pos < len && fmt[pos] == 'q')
+                spec._length = Length::LL, pos += 1;
+            else if (pos < len && fmt[pos] == 'j')
+                spec._length = Length::J, pos += 1;
+            else if (pos < len && fmt[pos] == 'z')
+                spec._length = Length::Z, pos += 1;
+            else if (pos < len && fmt[pos] == 't')
+                spec._length = Length::T, pos += 1;
+            else if (pos < len && fmt[pos] == 'L')
+                spec._length = Length::LD, pos += 1;
+            // 4) 转换字符: 宽字符(%lc/%ls/%C/%S), %n, %m 等不支持延迟处理
+            if (pos >= len || strchr("diouxXeEfFgGaAcsp", fmt[pos]) == nullptr || fmt[pos] == '\0')
+            {
+                return false;
+            }
+            spec._conv = fmt[pos];
+            spec._end = pos + 1;
+            if ((spec._conv == 'c' || spec._conv == 's') && spec._length != Length::NONE)
+            {
+                return false;
+            }
+            return spec._end - spec._begin < SPEC_SIZE;
+        }
+
+        // 按照转换说明依次从va_list中取出参数, 以8字节为单位拷贝到缓冲区
+        static bool encodeArgs(Buffer &out, const char *fmt, size_t len, ArgList &args)
+        {
+            for (size_t pos = 0; pos < len; pos++)
+            {
+                if (fmt[pos] != '%')
+                {
+                    continue;
+                }
+                if (pos + 1 < len && fmt[pos + 1] == '%')
+                {
+                    pos++;
+                    continue;
+                }
+                Spec spec;
+                if (parseSpec(fmt, len, pos + 1, spec) == false)
+                {
+                    return false;
+                }
+                int precision = spec._precision;
+                for (int i = 0; i < spec._stars; i++)
+                {
+                    int star = va_arg(args._ap, int);
+                    putValue(out, (int64_t)star);
+                    if (i == spec._stars - 1 && precision == PRECISION_STAR)
+                    {
+                        precision = star < 0 ? -1 : star; // 负的精度视为未指定
+                    }
+                }
+                switch (spec._conv)
+                {
+                case 'd':
+                case 'i':
+                    putValue(out, popSigned(spec._length, args));
+                    break;
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                    putValue(out, popUnsigned(spec._length, args));
+                    break;
+                case 'c':
+                    putValue(out, (int64_t)va_arg(args._ap, int));
+                    break;
+                case 'p':
+                    putValue(out, va_arg(args._ap, void *));
+                    break;
+                case 's':
+                    putString(out, va_arg(args._ap, const char *), precision);
+                    break;
+                default:
+                    if (spec._length == Length::LD)
+                    {
+                        putValue(out, va_arg(args._ap, long double));
+                    }
+                    else
+                    {
+                        putValue(out, va_arg(args._ap, double));
+                    }
+                }
+                pos = spec._end - 1;
+            }
+            return true;
+        }
+
+        static int64_t popSigned(Length length, ArgList &args)
+        {
+            switch (length)
+            {
+            case Length::L:
+                return va_arg(args._ap, long);
+            case Length::LL:
+                return va_arg(args._ap, long long);
+            case Length::J:
+                return va_arg(args._ap, intmax_t);
+            case Length::Z:
+                return va_arg(args._ap, ssize_t);
+            case Length::T:
+                return va_arg(args._ap, ptrdiff_t);
+            default:
+                return va_arg(args._ap, int);
+            }
+        }
+
+        static uint64_t popUnsigned(Length length, ArgList &args)
+        {
+            switch (length)
+            {
+            case Length::L:
+                return va_arg(args._ap, unsigned long);
+            case Length::LL:
+                return va_arg(args._ap, unsigned long long);
+            case Length::J:
+                return va_arg(args._ap, uintmax_t);
+            case Length::Z:
+                return va_arg(args._ap, size_t);
+            case Length::T:
+                return va_arg(args._ap, ptrdiff_t);
+            default:
+                return va_arg(args._ap, unsigned int);
+            }
+        }
+
+        template <typename T>
+        static void putValue(Buffer &out, T val)
+        {
+            size_t len = align(sizeof(T));
+            char *ptr = out.reserve(len);
+            memset(ptr, 0, len);
+            memcpy(ptr, &val, sizeof(T));
+            out.moveWriter(len);
+        }
+
+        // 字符串参数拷贝内容: [长度 + 数据 + '\0'], 空指针长度记为UINT64_MAX
+        // 指定了精度时最多读取precision个字节(与printf一致, 参数可以不以'\0'结尾), 结尾的'\0'由这里补上
+        static void putString(Buffer &out, const char *str, int precision)
+        {
+            uint64_t len = str == nullptr ? UINT64_MAX : precision < 0 ? strlen(str) : strnlen(str, precision);
+            putValue(out, len);
+            if (str != nullptr)
+            {
+                out.push(str, len);
+                out.push("", 1);
+                pad(out);
+            }
+        }
+
+    public:
+        // 按照转换说明依次取出参数: visitor.text(data, len)接收原始文本, visitor.arg(spec, nstars, stars, val)接收转换说明及其参数
+        template <typename Reader, typename Visitor>
+        static void walk(const char *fmt, size_t len, Reader &reader, Visitor &visitor)
+        {
+            size_t text = 0;
+            for (size_t pos = 0; pos < len; pos++)
+            {
+                if (fmt[pos] != '%')
+                {
+                    continue;
+                }
+                visitor.text(fmt + text, pos - text);
+                if (pos + 1 < len && fmt[pos + 1] == '%')
+                {
+                    visitor.text("%", 1);
+                    text = ++pos + 1;
+                    continue;
+                }
+                // 格式化字符串可能来自文件: 无法解析的转换说明及之后的内容原样输出, 不再读取参数
+                Spec spec;
+                if (parseSpec(fmt, len, pos + 1, spec) == false || spec._end - spec._begin >= SPEC_SIZE)
+                {
+                    visitor.text(fmt + pos, len - pos);
+                    return;
+                }
+                char spec_str[SPEC_SIZE];
+                memcpy(spec_str, fmt + spec._begin, spec._end - spec._begin);
+                spec_str[spec._end - spec._begin] = '\0';
+                int stars[2] = {0, 0};
+                for (int i = 0; i < spec._stars; i++)
+                {
+                    stars[i] = (int)reader.getSigned();
+                }
+                auto emit = [&](auto val)
+                {
+                    visitor.arg(spec_str, spec._stars, stars, val);
+                };
+                switch (spec._conv)
+                {
+                case 'd':
+                case 'i':
+                {
+                    int64_t val = reader.getSigned();
+                    switch (spec._length)
+                    {
+                    case Length::L:
+                        emit((long)val);
+                        break;
+                    case Length::LL:
+                        emit((long long)val);
+                        break;
+                    case Length::J:
+                        emit((intmax_t)val);
+                        break;
+                    case Length::Z:
+                        emit((ssize_t)val);
+                        break;
+                    case Length::T:
+                        emit((ptrdiff_t)val);
+                        break;
+                    default:
+                        emit((int)val);
+                    }
+                    break;
+                }
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                {
+                    uint64_t val = reader.getUnsigned();
+                    switch (spec._length)
+                    {
+                    case Length::L:
+                        emit((unsigned long)val);
+                        break;
+                    case Length::LL:
+                        emit((unsigned long long)val);
+                        break;
+                    case Length::J:
+                        emit((uintmax_t)val);
+                        break;
+                    case Length::Z:
+                        emit((size_t)val);
+                        break;
+                    case Length::T:
+                        emit((ptrdiff_t)val);
+                        break;
+                    default:
+                        emit((unsigned int)val);
+                    }
+                    break;
+                }
+                case 'c':
+                    emit((int)reader.getSigned());
+                    break;
+                case 'p':
+                    emit(reader.getPointer());
+                    break;
+                case 's':
+                    emit(reader.getString());
+                    break;
+                default:
+                    if (spec._length == Length::LD)
+                    {
+                        emit(reader.getLongDouble());
+                    }
+                    else
+                    {
+                        emit(reader.getDouble());
+                    }
+                }
+                pos = spec._end - 1;
+                text = spec._end;
+            }
+            visitor.text(fmt + text, len - text);
+        }
+
+        // 按照转换说明依次还原参数, 每个转换说明单独交给snprintf处理, 保证结果与vsnprintf一致
+        template <typename Reader>
+        static void render(Buffer &out, const char *fmt, size_t len, Reader &reader)
+        {
+            Printer printer{out};
+            walk(fmt, len, reader, printer);
+        }
+
+    private:
+        // render使用的visitor: 原始文本直接拷贝, 转换说明交给snprintf
+        struct Printer
+        {
+            Buffer &_out;
+            void text(const char *data, size_t len)
+            {
+                _out.push(data, len);
+            }
+            template <typename T>
+            void arg(const char *spec, int nstars, const int *stars, T val)
+            {
+                print(_out, spec, nstars, stars, val);
+            }
+        };
+
+        template <typename T>
+        static void print(Buffer &out, const char *spec, int nstars, const int *stars, T val)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                char *ptr = out.reserve(FORMAT_SIZE);
+                size_t avail = out.writeAbleSize();
+                int ret = 0;
+                if (nstars == 0)
+                    ret = snprintf(ptr, avail, spec, val);
+                else if (nstars == 1)
+                    ret = snprintf(ptr, avail, spec, stars[0], val);
+                else
+                    ret = snprintf(ptr, avail, spec, stars[0], stars[1], val);
+                if (ret < 0)
+                {
+                    return;
+                }
+                if ((size_t)ret < avail)
+                {
+                    out.moveWriter(ret);
+                    return;
+                }
+                out.reserve(ret + 1);
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef __M_RECORDER_H__
+#define __M_RECORDER_H__
+
+/*  飞行记录器: 进程内唯一的环形内存区, 保存所有日志器最近输出的日志(格式化之后的字符串)
+    1. 在生产者线程中记录, 不经过异步缓冲区与落地方向; 进程崩溃时异步缓冲区中还没有落地的日志也能保留下来
+    2. 有独立的记录等级, 低于日志器输出等级的日志也可以只进入记录器
+    3. 写入是无锁的: 原子地领取一个槽位序号, 拷贝数据后发布序号; 超过槽位大小的日志被截断
+    4. 收到SIGSEGV/SIGABRT等信号, 或者输出FATAL等级的日志时, 将记录的日志转储到文件; 转储过程只使用异步信号安全的函数
+    5. 延迟格式化模式或只有二进制落地方向的日志器, 启用记录器后会在生产者线程中额外完成一次格式化
+*/
+
+#include <atomic>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Level.hpp"
+
+#define FLIGHT_SLOTS 4096    // 记录器保存的日志条数
+#define FLIGHT_SLOT_SIZE 256 // 每条日志最多保存的字节数
+
+namespace tjq
+{
+    class FlightRecorder
+    {
+    public:
+        // 记录器常驻内存(不析构), 崩溃时的信号处理函数总是可以访问
+        static FlightRecorder &instance()
+        {
+            static FlightRecorder *recorder = new FlightRecorder();
+            return *recorder;
+        }
+
+        /*  启用记录器
+            path: 转储文件
+            level: 记录的最低等级(与日志器的输出等级无关)
+            signals: 是否在SIGSEGV/SIGABRT/SIGBUS/SIGFPE/SIGILL时转储(转储后交还给原来的处理方式)
+        */
+        void enable(const std::string &path, LogLevel::value level = LogLevel::value::DEBUG, bool signals = true)
+        {
+            size_t len = std::min(path.size(), sizeof(_path) - 1);
+            memcpy(_path, path.c_str(), len);
+            _path[len] = '\0';
+            if (signals && _installed.exchange(true) == false)
+            {
+                install();
+            }
+            limit().store(level, std::memory_order_release);
+        }
+        void disable()
+        {
+            limit().store(LogLevel::value::OFF, std::memory_order_release);
+        }
+
+        // 指定等级的日志是否需要记录(记录器未启用时总是false)
+        static bool wants(LogLevel::value level)
+        {
+            return level >= limit().load(std::memory_order_acquire);
+        }
+
+        // 记录一条日志: 领取槽位后写入数据并发布序号, 不加锁
+        void capture(const char *data, size_t len)
+        {
+            uint64_t seq = _next.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = _slots[seq % FLIGHT_SLOTS];
+            slot._seq.store(0, std::memory_order_relaxed); // 写入过程中序号无效, 转储时跳过
+            std::atomic_thread_fence(std::memory_order_release);
+            if (len > FLIGHT_SLOT_SIZE)
+            {
+                len = FLIGHT_SLOT_SIZE;
+                memcpy(slot._data, data, len - 1);
+                slot._data[len - 1] = '\n';
+            }
+            else
+            {
+                memcpy(slot._data, data, len);
+            }
+            slot._len = (uint32_t)len;
+            slot._seq.store(seq + 1, std::memory_order_release);
+        }
+
+        // 将记录的日志按照先后顺序转储到文件(覆盖之前的转储), 可以在信号处理函数中调用
+        void dump(const char *reason)
+        {
+            if (_dumping.exchange(true, std::memory_order_acquire))
+            {
+                return; // 转储过程中再次崩溃, 不重入
+            }
+            int fd = ::open(_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd >= 0)
+            {
+                dump(fd, reason);
+                ::close(fd);
+            }
+            _dumping.store(false, std::memory_order_release);
+        }
+        void dump(int fd, const char *reason)
+        {
+            const char title[] = "---- flight recorder: ";
+            writeAll(fd, title, sizeof(title) - 1);
+            writeAll(fd, reason, strlen(reason));
+            writeAll(fd, " ----\n", 6);
+            uint64_t end = _next.load(std::memory_order_acquire);
+            uint64_t begin = end > FLIGHT_SLOTS ? end - FLIGHT_SLOTS : 0;
+            char data[FLIGHT_SLOT_SIZE];
+            for (uint64_t seq = begin; seq < end; seq++)
+            {
+                // 拷贝前后序号一致才是完整的日志(正在写入或已经被覆盖的槽位跳过)
+                Slot &slot = _slots[seq % FLIGHT_SLOTS];
+                if (slot._seq.load(std::memory_order_acquire) != seq + 1)
+                {
+                    continue;
+                }
+                uint32_t size = slot._len;
+                memcpy(data, slot._data, size);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot._seq.load(std::memory_order_relaxed) != seq + 1)
+                {
+                    continue;
+                }
+                writeAll(fd, data, size);
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t> _seq; // 日志序号 + 1, 0表示正在写入
+            uint32_t _len;
+            char _data[FLIGHT_SLOT_SIZE];
+        };
+
+        FlightRecorder()
+            : _slots(new Slot[FLIGHT_SLOTS]),
+              _next(0),
+              _dumping(false),
+              _installed(false)
+        {
+            for (size_t i = 0; i < FLIGHT_SLOTS; i++)
+            {
+                _slots[i]._seq.store(0, std::memory_order_relaxed);
+                _slots[i]._len = 0;
+            }
+            _path[0] = '\0';
+        }
+
+        // 记录等级放在实例之外: 未启用时判断等级不会创建记录器
+        static std::atomic<LogLevel::value> &limit()
+        {
+            static std::atomic<LogLevel::value> level(LogLevel::value::OFF);
+            return level;
+        }
+
+        static const int *crashSignals(size_t &count)
+        {
+            static const int signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+            count = sizeof(signals) / sizeof(signals[0]);
+            return signals;
+        }
+        static struct sigaction *previous()
+        {
+            static struct sigaction actions[5];
+            return actions;
+        }
+
+        void install()
+        {
+            size_t count = 0;
+            const int *signals = crashSignals(count);
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = &FlightRecorder::onSignal;
+            sigemptyset(&action.sa_mask);
+            for (size_t i = 0; i < count; i++)
+            {
+                sigaction(signals[i], &action, &previous()[i]);
+            }
+        }
+
+        // 转储后恢复原来的处理方式并重新发送信号(默认处理方式下进程终止并产生core文件)
+        static void onSignal(int sig)
+        {
+            char reason[32] = "signal ";
+            size_t len = strlen(reason), digits = 0;
+            char tmp[16];
+            for (int value = sig; value > 0 || digits == 0; value /= 10)
+            {
+                tmp[digits++] = (char)('0' + value % 10);
+            }
+            while (digits > 0)
+            {
+                reason[len++] = tmp[--digits];
+            }
+            reason[len] = '\0';
+            instance().dump(reason);
+
+            size_t count = 0;
+            const int *signals = crashSignals(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (signals[i] == sig)
+                {
+                    sigaction(sig, &previous()[i], nullptr);
+                }
+            }
+            raise(sig);
+        }
+
+        static void writeAll(int fd, const char *data, size_t len)
+        {
+            while (len > 0)
+            {
+                ssize_t ret = ::write(fd, data, len);
+                if (ret < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ret <= 0)
+                {
+                    return;
+                }
+                data += ret;
+                len -= ret;
+            }
+        }
+
+    private:
+        Slot *_slots;
+        std::atomic<uint64_t> _next;  // 下一条日志的序号
+        std::atomic<bool> _dumping;   // 是否正在转储
+        std::atomic<bool> _installed; // 是否已经安装信号处理函数
+        char _path[PATH_MAX];         // 转储文件(信号处理函数中不能使用std::string)
+    };
+}
+
+#endif
@@ -5,16 +5,150 @@
     1. 抽象落地基类
     2. 派生子类(根据不同的落地方式进行派生)
     3. 使用工厂模式进行创建与表示的分离
+    4. 文件落地方向按照持久化策略刷新/同步
+    5. 落地方向可以拥有自己的格式化器与输出等级, 日志器按格式化器分组, 每种格式每条日志只格式化一次
 */
 
+#include <mutex>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <cassert>
+#include <cerrno>
 #include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "Tool.hpp"
+#include "Format.hpp"
+#include "Record.hpp"
+#include "Archive.hpp"
+
+#define FSYNC_INTERVAL 1000           // FLUSH_FSYNC策略默认的同步间隔(毫秒)
+#define FSYNC_BYTES (4 * 1024 * 1024) // FLUSH_FSYNC策略默认的同步数据量
 
 namespace tjq
 {
+    // 文件落地方向的持久化策略
+    enum class FlushType
+    {
+        FLUSH_NONE,  // 不主动刷新, 标准库缓冲区写满或关闭文件时才写入内核(吞吐量最高, 进程崩溃会丢失缓冲区中的日志)
+        FLUSH_BATCH, // 每批日志写入完毕后刷新到内核(进程崩溃不丢日志)
+        FLUSH_FSYNC  // 每批日志刷新到内核, 距上次同步超过指定时间或数据量时fsync(机器掉电最多丢失一个同步周期的日志)
+    };
+
+    /*  持久化策略
+        FlushPolicy(FlushType type, size_t interval, size_t bytes);
+        interval: FLUSH_FSYNC策略的同步间隔(毫秒)
+        bytes: FLUSH_FSYNC策略的同步数据量, 时间与数据量任意一个达到就进行同步
+    */
+    struct FlushPolicy
+    {
+        FlushPolicy(FlushType type = FlushType::FLUSH_NONE, size_t interval = FSYNC_INTERVAL, size_t bytes = FSYNC_BYTES)
+            : _type(type),
+              _interval(interval),
+              _bytes(bytes)
+        {
+        }
+        FlushType _type;
+        size_t _interval;
+        size_t _bytes;
+    };
+
+    /*  日志文件: 文件落地方向共用的写入与持久化实现
+        1. 数据写入标准库缓冲区, 单条日志不会产生系统调用
+        2. 日志器每写完一批日志调用一次flush, 按照持久化策略刷新/同步, 一次同步覆盖整批日志(组提交)
+        3. 空闲期间未同步的数据在下一批日志, 显式刷新或关闭文件时同步
+    */
+    class LogFile
+    {
+    public:
+        LogFile(const FlushPolicy &policy)
+            : _policy(policy),
+              _fp(nullptr),
+              _unsynced(0),
+              _last_sync(0)
+        {
+        }
+        ~LogFile()
+        {
+            close();
+        }
+
+        // 打开文件(已经打开的文件先关闭), 文件所在目录不存在则创建
+        void open(const std::string &pathname)
+        {
+            close();
+            tool::File::createDirectory(tool::File::path(pathname));
+            _fp = fopen(pathname.c_str(), "ab");
+            assert(_fp != nullptr);
+            _last_sync = now();
+        }
+        // 关闭文件, FLUSH_FSYNC策略下关闭前完成最后一次同步
+        void close()
+        {
+            if (_fp == nullptr)
+            {
+                return;
+            }
+            if (_policy._type == FlushType::FLUSH_FSYNC)
+            {
+                fflush(_fp);
+                fsync(fileno(_fp));
+            }
+            fclose(_fp);
+            _fp = nullptr;
+        }
+
+        void write(const char *data, size_t len)
+        {
+            size_t ret = fwrite(data, 1, len, _fp);
+            assert(ret == len);
+            (void)ret;
+            _unsynced += len;
+        }
+
+        // 一批日志写入完毕后调用; force为true时表示显式刷新, 忽略刷新策略中的时间与数据量条件
+        void flush(bool force)
+        {
+            if (_fp == nullptr || (_policy._type == FlushType::FLUSH_NONE && force == false))
+            {
+                return;
+            }
+            fflush(_fp);
+            if (_policy._type != FlushType::FLUSH_FSYNC || _unsynced == 0)
+            {
+                return;
+            }
+            uint64_t cur = now();
+            if (force || _unsynced >= _policy._bytes || cur - _last_sync >= _policy._interval)
+            {
+                fsync(fileno(_fp));
+                _unsynced = 0;
+                _last_sync = cur;
+            }
+        }
+
+    private:
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        FlushPolicy _policy;
+        FILE *_fp;
+        size_t _unsynced;    // 上次同步之后写入的数据量
+        uint64_t _last_sync; // 上次同步的时间(毫秒)
+    };
+
     class LogSink
     {
     public:
@@ -26,6 +160,233 @@ namespace tjq
         }
         using ptr = std::shared_ptr<LogSink>;
         virtual void log(const char *data, size_t len) = 0;
+
+        // 日志器每写完一批日志调用一次(同步日志器每条日志就是一批), 落地方向按照自己的持久化策略刷新
+        // force为true表示显式刷新(Logger::flush), 需要将缓冲的数据全部写出
+        virtual void flush(bool force)
+        {
+        }
+
+        // 需要原始日志记录(而不是格式化后的字符串)的落地方向重写这两个接口, 例如二进制日志文件
+        // 日志器不会再将格式化后的字符串交给这类落地方向
+        virtual bool needRecord()
+        {
+            return false;
+        }
+        virtual void logRecord(const std::string &logger, const RecordHeader &hdr, const char *body)
+        {
+        }
+
+        // 分片异步日志器为第index个分片(从1开始)创建独立的落地方向, 写入独立的输出分段
+        // 返回空指针表示不支持分片, 各个分片共用同一个落地方向(加锁保护)
+        virtual LogSink::ptr shard(size_t index)
+        {
+            return LogSink::ptr();
+        }
+
+        /*  落地方向自己的格式化器与输出等级, 需要在交给日志器之前设置
+            1. 没有设置格式化器时使用日志器的格式化器; 需要原始日志记录的落地方向不使用格式化器
+            2. 低于输出等级的日志不交给该落地方向(日志器的输出等级先生效)
+        */
+        void setFormatter(const Formatter::ptr &formatter)
+        {
+            _formatter = formatter;
+        }
+        void setFormatter(const std::string &pattern)
+        {
+            _formatter = std::make_shared<Formatter>(pattern);
+        }
+        const Formatter::ptr &formatter() const
+        {
+            return _formatter;
+        }
+        void setLevel(LogLevel::value level)
+        {
+            _level = level;
+        }
+        LogLevel::value level() const
+        {
+            return _level;
+        }
+        // 是否需要单独格式化或按等级过滤(不能直接使用日志器格式化好的整批数据)
+        bool custom() const
+        {
+            return _formatter.get() != nullptr || _level != LogLevel::value::UNKNOW;
+        }
+
+    private:
+        Formatter::ptr _formatter;
+        LogLevel::value _level = LogLevel::value::UNKNOW;
+    };
+
+    /*  按格式化器分组的文本落地方向: 共用同一个格式化器对象的落地方向, 每条日志只格式化一次
+        1. 组内再按输出等级分为多路, 每一路拥有自己的输出缓冲区, 整批日志写入完毕后再交给该路的落地方向
+        2. 一条日志在组内第一个需要它的路中格式化, 其余需要的路直接拷贝格式化结果
+        3. 没有设置格式化器的落地方向使用日志器的格式化器(格式化时传入)
+    */
+    class SinkGroups
+    {
+    public:
+        struct Lane
+        {
+            Lane()
+                : _output(FORMAT_BUFFER_SIZE)
+            {
+            }
+            LogLevel::value _level;
+            std::vector<LogSink::ptr> _sinks;
+            Buffer _output;
+        };
+
+        SinkGroups()
+        {
+        }
+        explicit SinkGroups(const std::vector<LogSink::ptr> &sinks)
+        {
+            for (auto &sink : sinks)
+            {
+                Group &group = find(sink->formatter().get());
+                Lane *lane = nullptr;
+                for (auto *item : group._lanes)
+                {
+                    lane = item->_level == sink->level() ? item : lane;
+                }
+                if (lane == nullptr)
+                {
+                    _lanes.emplace_back(new Lane());
+                    lane = _lanes.back().get();
+                    lane->_level = sink->level();
+                    group._lanes.push_back(lane);
+                }
+                lane->_sinks.push_back(sink);
+            }
+        }
+
+        bool empty() const
+        {
+            return _lanes.empty();
+        }
+        // 所有落地方向都使用日志器的格式化器且没有等级限制, 可以直接使用日志器格式化好的数据
+        bool plain() const
+        {
+            return _lanes.size() <= 1 && _groups.size() <= 1 &&
+                   (_groups.empty() || (_groups[0]._formatter == nullptr && _lanes[0]->_level == LogLevel::value::UNKNOW));
+        }
+        const std::vector<std::unique_ptr<Lane>> &lanes() const
+        {
+            return _lanes;
+        }
+
+        // 开始新的一批日志
+        void reset()
+        {
+            for (auto &lane : _lanes)
+            {
+                lane->_output.reset();
+            }
+        }
+
+        // 将一条日志写入需要它的每一路; formatted不为空时是使用日志器格式化器得到的结果, 直接拷贝
+        void format(const LogMessage &msg, Formatter &fallback, std::string_view formatted = std::string_view())
+        {
+            for (auto &group : _groups)
+            {
+                Lane *first = nullptr;
+                size_t start = 0;
+                for (auto *lane : group._lanes)
+                {
+                    if (msg._level < lane->_level)
+                    {
+                        continue;
+                    }
+                    if (first != nullptr)
+                    {
+                        lane->_output.push(first->_output.begin() + start, first->_output.readAbleSize() - start);
+                        continue;
+                    }
+                    first = lane;
+                    start = lane->_output.readAbleSize();
+                    if (group._formatter == nullptr && formatted.empty() == false)
+                        lane->_output.push(formatted.data(), formatted.size());
+                    else
+                        (group._formatter == nullptr ? fallback : *group._formatter).format(lane->_output, msg);
+                }
+            }
+        }
+
+    private:
+        struct Group
+        {
+            Formatter *_formatter; // 为空表示使用日志器的格式化器
+            std::vector<Lane *> _lanes;
+        };
+        Group &find(Formatter *formatter)
+        {
+            for (auto &group : _groups)
+            {
+                if (group._formatter == formatter)
+                {
+                    return group;
+                }
+            }
+            _groups.push_back(Group{formatter, {}});
+            return _groups.back();
+        }
+
+    private:
+        std::vector<Group> _groups;
+        std::vector<std::unique_ptr<Lane>> _lanes;
+    };
+
+    /*  日志器使用的落地方向列表快照
+        1. 发布之后列表不再修改: 重新配置时构造新的快照, 原子地替换指针, 写入方在落地锁内以acquire读取当前快照
+        2. 被替换下的快照由重新配置的一方在获取一次落地锁之后释放, 此时不会再有写入使用它
+        3. 分组中各路的输出缓冲区会被修改, 只在写入方的落地锁内使用
+    */
+    struct SinkList
+    {
+        SinkList(const std::vector<LogSink::ptr> &sinks, const std::vector<LogSink::ptr> &record_sinks)
+            : _sinks(sinks),
+              _record_sinks(record_sinks),
+              _groups(sinks)
+        {
+        }
+        const std::vector<LogSink::ptr> _sinks;        // 接收格式化后字符串的落地方向
+        const std::vector<LogSink::ptr> _record_sinks; // 接收原始日志记录的落地方向
+        SinkGroups _groups;                            // 文本落地方向按格式化器分组
+    };
+
+    // 多个工作线程共用同一个落地方向时, 通过该类型加锁保护
+    class SharedSink : public LogSink
+    {
+    public:
+        SharedSink(const LogSink::ptr &sink)
+            : _sink(sink)
+        {
+        }
+        void log(const char *data, size_t len) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _sink->log(data, len);
+        }
+        void flush(bool force) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _sink->flush(force);
+        }
+        bool needRecord() override
+        {
+            return _sink->needRecord();
+        }
+        void logRecord(const std::string &logger, const RecordHeader &hdr, const char *body) override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _sink->logRecord(logger, hdr, body);
+        }
+
+    private:
+        LogSink::ptr _sink;
+        std::mutex _mutex;
     };
 
     // 落地方向: 标准输出
@@ -37,104 +398,394 @@ namespace tjq
         {
             std::cout.write(data, len);
         }
+        void flush(bool force) override
+        {
+            if (force)
+            {
+                std::cout.flush();
+            }
+        }
+    };
+
+    // 落地方向: 丢弃所有日志, 用于测量日志器前端(组织消息, 格式化, 写入缓冲区)的开销
+    class NullSink : public LogSink
+    {
+    public:
+        void log(const char *data, size_t len)
+        {
+        }
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<NullSink>();
+        }
     };
 
     /*  落地方向: 指定文件
-        FileSink(const std::string &pathname);
+        FileSink(const std::string &pathname, const FlushPolicy &policy);
         pathname: 文件名
+        policy: 持久化策略(默认不主动刷新)
     */
     class FileSink : public LogSink
     {
     public:
         // 构造时传入文件名, 并打开文件, 将操作句柄管理起来
-        FileSink(const std::string &pathname)
-            : _pathname(pathname)
+        FileSink(const std::string &pathname, const FlushPolicy &policy = FlushPolicy())
+            : _pathname(pathname),
+              _policy(policy),
+              _file(policy)
         {
-            // 1) 创建日志文件所在的目录
-            tool::File::createDirectory(tool::File::path(pathname));
-            // 2) 创建并打开日志文件
-            _ofs.open(_pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            _file.open(_pathname);
         }
         // 将日志消息写入到指定文件
         void log(const char *data, size_t len)
         {
-            _ofs.write(data, len);
-            assert(_ofs.good());
+            _file.write(data, len);
+        }
+        void flush(bool force) override
+        {
+            _file.flush(force);
+        }
+        // 分片写入 pathname.index
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<FileSink>(_pathname + "." + std::to_string(index), _policy);
         }
 
     private:
         std::string _pathname;
-        std::ofstream _ofs;
+        FlushPolicy _policy;
+        LogFile _file;
     };
 
     /*  落地方向: 滚动文件(以大小进行滚动)
-        RollBySizeSink(const std::string &basename, size_t max_size);
+        RollBySizeSink(const std::string &basename, size_t max_size, const FlushPolicy &policy, const ArchivePolicy &archive);
         basename: 基础文件名
         max_size: 单个文件最大大小
+        policy: 持久化策略(默认不主动刷新)
+        archive: 归档策略(默认不压缩, 不清理旧文件)
     */
     class RollBySizeSink : public LogSink
     {
     public:
         // 构造时传入文件名, 并打开文件, 将操作句柄管理起来
-        RollBySizeSink(const std::string &basename, size_t max_size)
+        RollBySizeSink(const std::string &basename, size_t max_size, const FlushPolicy &policy = FlushPolicy(), const ArchivePolicy &archive = ArchivePolicy())
             : _basename(basename),
               _max_fsize(max_size),
               _cur_fsize(0),
-              _name_count(0)
+              _name_count(0),
+              _policy(policy),
+              _file(policy),
+              _archive(archive)
         {
-            std::string pathname = createNewFile();
-            // 1) 创建日志文件所在的目录
-            tool::File::createDirectory(tool::File::path(pathname));
-            // 2) 创建并打开日志文件
-            _ofs.open(pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            _pathname = createNewFile();
+            _file.open(_pathname);
+            if (_archive.enabled())
+            {
+                _archiver = Archiver::instance();
+                _archiver->opened(_pathname);
+            }
         }
         // 将日志消息写入到指定文件 - 写入前判断文件大小, 超过了最大大小就要切换文件
         void log(const char *data, size_t len)
         {
             if (_cur_fsize >= _max_fsize)
             {
-                _ofs.close(); // 关闭原来已经打开的文件
-                std::string pathname = createNewFile();
-                _ofs.open(pathname, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
+                std::string old = _pathname;
+                _pathname = createNewFile();
+                _file.open(_pathname); // 关闭原来已经打开的文件, 打开新文件
                 _cur_fsize = 0;
+                if (_archiver.get() != nullptr)
+                {
+                    _archiver->opened(_pathname);
+                    _archiver->closed(_basename, old, _archive); // 旧文件交给后台线程归档
+                }
             }
-            _ofs.write(data, len);
-            assert(_ofs.good());
+            _file.write(data, len);
             _cur_fsize += len;
         }
+        void flush(bool force) override
+        {
+            _file.flush(force);
+        }
+        // 分片以 basename + index + "-" 作为基础文件名
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<RollBySizeSink>(_basename + std::to_string(index) + "-", _max_fsize, _policy, _archive);
+        }
 
-    private:
-        // 进行大小判断, 超过指定大小则创建新文件
-        std::string createNewFile()
+        // 滚动文件名: 基础文件名 + 当前时间 + "-" + 序号 + ".log"
+        static std::string fileName(const std::string &basename, size_t count)
         {
-            // 获取系统时间, 以时间来构造文件扩展名
+            // 获取系统时间, 以时间来构造文件扩展名(固定14位, 归档清理按这个形式识别文件)
             time_t t = tool::Date::now();
             struct tm lt;
             localtime_r(&t, &lt);
             std::stringstream filename;
-            filename << _basename;
-            filename << lt.tm_year + 1900;
-            filename << lt.tm_mon + 1;
-            filename << lt.tm_mday;
-            filename << lt.tm_hour;
-            filename << lt.tm_min;
-            filename << lt.tm_sec;
+            filename << basename << std::setfill('0');
+            filename << std::setw(4) << lt.tm_year + 1900;
+            filename << std::setw(2) << lt.tm_mon + 1;
+            filename << std::setw(2) << lt.tm_mday;
+            filename << std::setw(2) << lt.tm_hour;
+            filename << std::setw(2) << lt.tm_min;
+            filename << std::setw(2) << lt.tm_sec;
             filename << "-";
-            filename << _name_count++;
+            filename << count;
             filename << ".log";
             return filename.str();
         }
 
+    private:
+        // 进行大小判断, 超过指定大小则创建新文件
+        std::string createNewFile()
+        {
+            return fileName(_basename, _name_count++);
+        }
+
     private:
         // 通过基础文件名 + 扩展文件名(以时间生成), 组成一个实际的当前输出文件名
         std::string _basename; // ./logs/base- + 20030925131452.log
         size_t _max_fsize;     // 记录最大大小, 当前文件超过了这个大小就要切换文件
         size_t _cur_fsize;     // 记录当前文件已经写入的数据大小
         size_t _name_count;
-        std::ofstream _ofs;
+        FlushPolicy _policy;
+        LogFile _file;
+        std::string _pathname; // 当前输出文件名
+        ArchivePolicy _archive;
+        Archiver::ptr _archiver;
+    };
+
+    /*  落地方向: 滚动文件(以大小进行滚动, 内存映射写入, 文件名与RollBySizeSink相同)
+        1. 每个文件创建时预先分配max_size大小的磁盘空间并整体映射, 写入只是一次内存拷贝, 没有系统调用
+        2. 切换文件(或析构)时解除映射, 并将文件截断为实际写入的大小
+        3. 一个文件放不下整批数据时, 在最后一个能放下的换行处切分, 单条日志不会跨越两个文件
+        4. 进程崩溃时当前文件保留预分配的大小, 实际数据之后是填充的'\0'
+        5. FLUSH_FSYNC策略通过msync同步, 其余策略下写入的数据对其他进程立即可见, 不需要刷新
+        6. 归档策略与RollBySizeSink相同, 旧文件在截断之后交给后台线程归档
+        7. 预分配因磁盘空间不足等原因失败时不做映射(写入没有分配磁盘块的页会触发SIGBUS), 该文件退化为write追加写入,
+           write仍然失败的数据被丢弃并计入dropped(), 错误只输出一次
+    */
+    class MmapRollSink : public LogSink
+    {
+    public:
+        MmapRollSink(const std::string &basename, size_t max_size, const FlushPolicy &policy = FlushPolicy(), const ArchivePolicy &archive = ArchivePolicy())
+            : _basename(basename),
+              _max_fsize(max_size),
+              _cur_fsize(0),
+              _name_count(0),
+              _policy(policy),
+              _fd(-1),
+              _base(nullptr),
+              _synced(0),
+              _last_sync(0),
+              _dropped(0),
+              _reported(false),
+              _archive(archive)
+        {
+            assert(_max_fsize > 0);
+            if (_archive.enabled())
+            {
+                _archiver = Archiver::instance();
+            }
+            openFile();
+        }
+        ~MmapRollSink()
+        {
+            closeFile();
+        }
+
+        void log(const char *data, size_t len) override
+        {
+            while (len > 0)
+            {
+                if (_cur_fsize >= _max_fsize)
+                {
+                    rollFile();
+                }
+                size_t room = _max_fsize - _cur_fsize, n = len;
+                if (n > room)
+                {
+                    const char *nl = (const char *)memrchr(data, '\n', room);
+                    if (nl == nullptr && _cur_fsize > 0)
+                    {
+                        rollFile(); // 剩余空间放不下一整条日志, 直接切换到新文件
+                        continue;
+                    }
+                    n = nl == nullptr ? room : nl - data + 1; // 单条日志超过文件大小时才会被切分
+                }
+                store(data, n);
+                data += n;
+                len -= n;
+            }
+        }
+        void flush(bool force) override
+        {
+            if (_policy._type != FlushType::FLUSH_FSYNC || _synced == _cur_fsize)
+            {
+                return;
+            }
+            uint64_t cur = now();
+            if (force || _cur_fsize - _synced >= _policy._bytes || cur - _last_sync >= _policy._interval)
+            {
+                sync();
+                _last_sync = cur;
+            }
+        }
+        // 分片以 basename + index + "-" 作为基础文件名
+        LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<MmapRollSink>(_basename + std::to_string(index) + "-", _max_fsize, _policy, _archive);
+        }
+        // 因为写入失败而丢弃的数据量(字节)
+        size_t dropped()
+        {
+            return _dropped;
+        }
+
+    private:
+        // 打开(或续写)新文件, 预分配空间并映射
+        void openFile()
+        {
+            _pathname = RollBySizeSink::fileName(_basename, _name_count++);
+            tool::File::createDirectory(tool::File::path(_pathname));
+            _fd = ::open(_pathname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            assert(_fd >= 0);
+            struct stat st;
+            fstat(_fd, &st);
+            _cur_fsize = _synced = st.st_size;
+            _last_sync = now();
+            // 只有文件系统不支持预分配时才退化为稀疏文件, 其他错误(如ENOSPC)说明磁盘块无法保证, 不能映射
+            int err = _cur_fsize < _max_fsize ? posix_fallocate(_fd, 0, _max_fsize) : 0;
+            if (err == EOPNOTSUPP || err == EINVAL)
+            {
+                err = ftruncate(_fd, _max_fsize) == 0 ? 0 : errno;
+            }
+            void *addr = err == 0 ? mmap(nullptr, _max_fsize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0) : MAP_FAILED;
+            if (addr == MAP_FAILED)
+            {
+                report(err == 0 ? "mmap" : "posix_fallocate", err == 0 ? errno : err);
+                // 去掉预分配失败时可能留下的空间, 之后从实际数据末尾追加写入
+                if (ftruncate(_fd, _cur_fsize) != 0 || lseek(_fd, _cur_fsize, SEEK_SET) < 0)
+                {
+                    report("ftruncate", errno);
+                }
+                addr = nullptr;
+            }
+            _base = (char *)addr;
+            if (_archiver.get() != nullptr)
+            {
+                _archiver->opened(_pathname);
+            }
+        }
+        // 解除映射, 截断为实际大小后关闭文件
+        void closeFile()
+        {
+            if (_fd < 0)
+            {
+                return;
+            }
+            if (_policy._type == FlushType::FLUSH_FSYNC)
+            {
+                sync();
+            }
+            if (_base != nullptr)
+            {
+                munmap(_base, _max_fsize);
+            }
+            if (ftruncate(_fd, _cur_fsize) == 0 && _policy._type == FlushType::FLUSH_FSYNC)
+            {
+                fsync(_fd);
+            }
+            ::close(_fd);
+            _fd = -1;
+            _base = nullptr;
+        }
+        void rollFile()
+        {
+            closeFile();
+            std::string old = _pathname;
+            openFile();
+            if (_archiver.get() != nullptr)
+            {
+                _archiver->closed(_basename, old, _archive);
+            }
+        }
+        // 写入当前文件: 映射时只是内存拷贝, 退化时通过write追加, 失败的数据丢弃并计数
+        void store(const char *data, size_t len)
+        {
+            if (_base != nullptr)
+            {
+                memcpy(_base + _cur_fsize, data, len);
+                _cur_fsize += len;
+                return;
+            }
+            while (len > 0)
+            {
+                ssize_t ret = ::write(_fd, data, len);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    report("write", errno);
+                    _dropped += len;
+                    return;
+                }
+                _cur_fsize += ret;
+                data += ret;
+                len -= ret;
+            }
+        }
+        // 错误只输出一次, 避免磁盘写满时每批日志都刷屏
+        void report(const char *what, int err)
+        {
+            if (_reported)
+            {
+                return;
+            }
+            _reported = true;
+            std::cerr << "Sink.hpp::MmapRollSink: " << what << " " << _pathname << " failed: " << strerror(err) << std::endl;
+        }
+        // 同步上次同步之后写入的数据(起始地址按页对齐)
+        void sync()
+        {
+            if (_synced >= _cur_fsize)
+            {
+                return;
+            }
+            if (_base == nullptr)
+            {
+                fdatasync(_fd);
+                _synced = _cur_fsize;
+                return;
+            }
+            static const size_t page = sysconf(_SC_PAGESIZE);
+            size_t begin = _synced / page * page;
+            msync(_base + begin, _cur_fsize - begin, MS_SYNC);
+            _synced = _cur_fsize;
+        }
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    private:
+        std::string _basename;
+        std::string _pathname; // 当前输出文件名
+        size_t _max_fsize;     // 文件大小(预分配与映射的大小)
+        size_t _cur_fsize;     // 当前文件已经写入的数据大小
+        size_t _name_count;
+        FlushPolicy _policy;
+        int _fd;
+        char *_base;           // 映射的起始地址
+        size_t _synced;        // 已经同步到磁盘的数据大小
+        uint64_t _last_sync;   // 上次同步的时间(毫秒)
+        size_t _dropped;       // 写入失败丢弃的数据大小
+        bool _reported;        // 是否已经输出过错误
+        ArchivePolicy _archive;
+        Archiver::ptr _archiver;
     };
 
     class SinkFactory
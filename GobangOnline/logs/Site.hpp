@@ -0,0 +1,61 @@
+#ifndef __M_SITE_H__
+#define __M_SITE_H__
+
+/*  调用点描述: 每个打印日志的位置对应一个静态对象, 保存源码文件名/行号/日志等级/格式化字符串
+    1. 由宏函数在调用点定义静态局部对象, 构造函数是constexpr, 对象在编译期完成初始化, 运行时没有任何开销
+    2. 日志消息/日志记录只携带调用点的指针, 文件名与行号都从调用点中读取
+    3. 编号在第一次使用时分配, 进程内唯一且不会改变
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "Level.hpp"
+
+namespace tjq
+{
+    struct CallSite
+    {
+        constexpr CallSite(const char *file, size_t line, LogLevel::value level, const char *fmt = nullptr)
+            : _file(file),
+              _line(line),
+              _level(level),
+              _fmt(fmt),
+              _id(0)
+        {
+        }
+
+        // 调用点编号(从1开始)
+        uint32_t id() const
+        {
+            uint32_t id = _id.load(std::memory_order_relaxed);
+            if (id != 0)
+            {
+                return id;
+            }
+            static std::atomic<uint32_t> count(0);
+            uint32_t expected = 0;
+            id = count.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (_id.compare_exchange_strong(expected, id, std::memory_order_relaxed) == false)
+            {
+                return expected; // 其他线程已经分配了编号
+            }
+            return id;
+        }
+
+        const char *_file;                 // 源码文件名
+        size_t _line;                      // 行号
+        LogLevel::value _level;            // 日志等级
+        const char *_fmt;                  // 格式化字符串(只有字面量才会记录, 否则为nullptr)
+        mutable std::atomic<uint32_t> _id; // 调用点编号
+    };
+}
+
+// 在调用点定义静态的调用点描述对象, level为LogLevel::value中的枚举名, fmt为字符串字面量或nullptr
+#define TJQ_CALL_SITE(level, fmt)                                                                   \
+    ([]() -> const tjq::CallSite & {                                                                \
+        static tjq::CallSite tjq_site_(__FILE__, __LINE__, tjq::LogLevel::value::level, fmt);       \
+        return tjq_site_;                                                                           \
+    }())
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef __M_STATS_H__
+#define __M_STATS_H__
+
+/*  日志器运行时统计
+    1. Histogram: 无锁的对数分桶直方图(第i个桶统计[2^(i-1), 2^i)范围内的值), 用于批次大小与落地耗时
+    2. LooperStats: 异步工作器的统计快照(写入/处理的日志条数与字节数, 批次, 生产者等待, 缓冲区扩容, 丢弃)
+    3. LoggerStats: 日志器的统计快照(落地方向写入耗时, 以及各个分片工作器的统计)
+    计数器都是relaxed原子变量, 快照中各项数据之间不保证严格一致
+*/
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "Fmt.hpp"
+#include "Buffer.hpp"
+
+#define STATS_BUCKETS 48 // 直方图桶数量, 最大可以统计到2^47
+
+namespace tjq
+{
+    struct HistogramSnapshot
+    {
+        uint64_t _count = 0;
+        uint64_t _sum = 0;
+        uint64_t _max = 0;
+        std::vector<uint64_t> _buckets = std::vector<uint64_t>(STATS_BUCKETS);
+
+        uint64_t mean() const
+        {
+            return _count == 0 ? 0 : _sum / _count;
+        }
+        // 百分位数(p取值0~100), 返回所在桶的上界(不超过最大值)
+        uint64_t percentile(double p) const
+        {
+            if (_count == 0)
+            {
+                return 0;
+            }
+            uint64_t target = (uint64_t)(_count * p / 100.0);
+            target = target == 0 ? 1 : target;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < _buckets.size(); i++)
+            {
+                seen += _buckets[i];
+                if (seen >= target)
+                {
+                    uint64_t upper = i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (1ull << i) - 1);
+                    return upper < _max ? upper : _max;
+                }
+            }
+            return _max;
+        }
+        void merge(const HistogramSnapshot &other)
+        {
+            _count += other._count;
+            _sum += other._sum;
+            _max = _max < other._max ? other._max : _max;
+            for (size_t i = 0; i < _buckets.size(); i++)
+            {
+                _buckets[i] += other._buckets[i];
+            }
+        }
+    };
+
+    class Histogram
+    {
+    public:
+        Histogram()
+        {
+            for (auto &bucket : _buckets)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+        void record(uint64_t value)
+        {
+            size_t idx = value == 0 ? 0 : 64 - __builtin_clzll(value);
+            idx = idx < STATS_BUCKETS ? idx : STATS_BUCKETS - 1;
+            _buckets[idx].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t max = _max.load(std::memory_order_relaxed);
+            while (value > max && _max.compare_exchange_weak(max, value, std::memory_order_relaxed) == false)
+            {
+            }
+        }
+        HistogramSnapshot snapshot() const
+        {
+            HistogramSnapshot snap;
+            snap._count = _count.load(std::memory_order_relaxed);
+            snap._sum = _sum.load(std::memory_order_relaxed);
+            snap._max = _max.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < STATS_BUCKETS; i++)
+            {
+                snap._buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+            }
+            return snap;
+        }
+
+    private:
+        std::atomic<uint64_t> _buckets[STATS_BUCKETS];
+        std::atomic<uint64_t> _count{0};
+        std::atomic<uint64_t> _sum{0};
+        std::atomic<uint64_t> _max{0};
+    };
+
+    struct LooperStats
+    {
+        uint64_t _records_in = 0;      // 写入工作器的日志条数(无锁工作器在工作线程取出时统计)
+        uint64_t _bytes_in = 0;        // 写入工作器的字节数
+        uint64_t _records_out = 0;     // 交给回调处理完毕的日志条数(已写入后又被DROP_OLDEST丢弃的不计入)
+        uint64_t _bytes_out = 0;       // 交给回调处理完毕的字节数
+        uint64_t _pending_bytes = 0;   // 当前缓冲区中等待处理的字节数(队列深度)
+        uint64_t _waits = 0;           // 生产者因缓冲区满而等待的次数
+        uint64_t _wait_ns = 0;         // 生产者等待的总时间(纳秒)
+        uint64_t _buffer_growths = 0;  // 生产缓冲区扩容次数
+        uint64_t _dropped_records = 0; // 因缓冲区满而丢弃的日志条数
+        uint64_t _dropped_bytes = 0;   // 因缓冲区满而丢弃的字节数
+        HistogramSnapshot _batch_bytes; // 每批交给回调处理的字节数
+
+        void merge(const LooperStats &other)
+        {
+            _records_in += other._records_in;
+            _bytes_in += other._bytes_in;
+            _records_out += other._records_out;
+            _bytes_out += other._bytes_out;
+            _pending_bytes += other._pending_bytes;
+            _waits += other._waits;
+            _wait_ns += other._wait_ns;
+            _buffer_growths += other._buffer_growths;
+            _dropped_records += other._dropped_records;
+            _dropped_bytes += other._dropped_bytes;
+            _batch_bytes.merge(other._batch_bytes);
+        }
+    };
+
+    struct LoggerStats
+    {
+        std::string _name;
+        bool _async = false;
+        uint64_t _records = 0;             // 同步日志器: 落地的日志条数; 异步日志器: 所有分片处理完毕的条数
+        uint64_t _bytes = 0;
+        HistogramSnapshot _sink_latency;   // 单次写入落地方向的耗时(纳秒)
+        std::vector<LooperStats> _loopers; // 异步日志器各个分片工作器的统计
+        uint64_t _buffer_growths = 0;      // 进程内所有缓冲区的扩容次数(包括格式化使用的线程局部缓冲区)
+
+        LooperStats total() const
+        {
+            LooperStats sum;
+            for (auto &looper : _loopers)
+            {
+                sum.merge(looper);
+            }
+            return sum;
+        }
+
+        // 单行的统计摘要, 用于周期性的自我报告
+        std::string toString() const
+        {
+            Buffer out(512);
+            format::print(out, "stats logger={} records={} bytes={} sink_p50={}ns sink_p99={}ns sink_max={}ns",
+                          _name, _records, _bytes, _sink_latency.percentile(50), _sink_latency.percentile(99), _sink_latency._max);
+            if (_async)
+            {
+                LooperStats sum = total();
+                format::print(out, " in={}/{}B pending={}B batches={} batch_p50={}B batch_max={}B waits={} wait={}us growths={} dropped={}/{}B",
+                              sum._records_in, sum._bytes_in, sum._pending_bytes, sum._batch_bytes._count,
+                              sum._batch_bytes.percentile(50), sum._batch_bytes._max, sum._waits, sum._wait_ns / 1000,
+                              sum._buffer_growths, sum._dropped_records, sum._dropped_bytes);
+            }
+            format::print(out, " buffer_growths={}", _buffer_growths);
+            return std::string(out.begin(), out.readAbleSize());
+        }
+    };
+
+    // 单调时钟(纳秒), 用于统计耗时
+    inline uint64_t statsClock()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+}
+
+#endif
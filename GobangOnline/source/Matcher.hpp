@@ -88,7 +88,8 @@ public:
         bool ret = _ut->select_by_id(uid, user);
         if (ret == false)
         {
-            DEBUG("获取玩家: %d 信息失败!", uid);
+            // 客户端反复发起匹配时可能大量失败, 每秒最多输出10条
+            DEBUG_LIMITED(10, 10, "获取玩家: %lu 信息失败!", uid);
             return false;
         }
         // 2. 添加到指定的队列中
@@ -90,6 +90,8 @@ public:
         // 3. 判断走棋位置, 判断当前走棋是否合理(位置是否已经被占用)
         if (_board[chess_row][chess_col] != 0)
         {
+            // 客户端可能反复发送非法落子, 每秒最多输出10条
+            DEBUG_LIMITED(10, 10, "%lu: 用户: %lu 落子位置(%d, %d)已被占用!", _room_id, cur_uid, chess_row, chess_col);
             json_resp["result"] = false;
             json_resp["reason"] = "当前位置已经有了其他棋子";
             return json_resp;
@@ -0,0 +1,499 @@
+/*  日志器基准测试: 按照 工作模式 x 工作器 x 溢出策略 x 落地方向 x 线程数量 x 消息长度 组合逐个测试
+    1. 每次调用日志接口的耗时记录到线程独立的对数-线性直方图(无原子操作), 输出p50/p99/p99.9/最大值
+    2. 吞吐量按照耗时最长的生产者线程计算, 另外统计生产者结束后落地方向处理完剩余日志的时间
+    3. null落地方向丢弃所有日志, 结果只包含前端(组织消息, 格式化, 写入缓冲区)的开销
+    4. 结果可以同时写入CSV/JSON文件, 通过label区分不同的构建版本
+
+    ./bench --threads 1,2,4,8 --sizes 16,128,1024 --count 200000 --label O2 --csv o2.csv --json o2.json
+    ./bench --modes async --loopers buffer --sinks null --policies safe,drop_newest
+*/
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <dirent.h>
+#include "../logs/Log.h"
+#include "../logs/RawSink.hpp"
+#include "../logs/BinarySink.hpp"
+#include "../extend/TimeSink.hpp"
+
+#define BENCH_DIR "./logfile/bench/" // 文件类落地方向的输出目录, 每次测试结束后清空
+
+// 对数-线性直方图: 每个2的幂次区间再等分为16个子桶, 分位数的相对误差不超过1/16
+// 每个线程独立使用一个实例, 测试结束后合并, 记录时没有任何同步开销
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SUB_BITS = 4,
+        SUB_COUNT = 1 << SUB_BITS,
+        BUCKETS = 64 * SUB_COUNT
+    };
+
+    LatencyHistogram()
+        : _counts(BUCKETS, 0), _count(0), _sum(0), _max(0)
+    {
+    }
+    void record(uint64_t value)
+    {
+        _counts[index(value)]++;
+        _count++;
+        _sum += value;
+        _max = value > _max ? value : _max;
+    }
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            _counts[i] += other._counts[i];
+        }
+        _count += other._count;
+        _sum += other._sum;
+        _max = other._max > _max ? other._max : _max;
+    }
+    // 百分位数(p取值0~100), 返回所在子桶的上界(不超过最大值)
+    uint64_t percentile(double p) const
+    {
+        if (_count == 0)
+        {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(_count * p / 100.0 + 0.5);
+        target = target == 0 ? 1 : target;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += _counts[i];
+            if (seen >= target)
+            {
+                uint64_t upper = upperBound(i);
+                return upper < _max ? upper : _max;
+            }
+        }
+        return _max;
+    }
+    uint64_t mean() const
+    {
+        return _count == 0 ? 0 : _sum / _count;
+    }
+    uint64_t max() const
+    {
+        return _max;
+    }
+
+private:
+    static size_t index(uint64_t value)
+    {
+        if (value < SUB_COUNT)
+        {
+            return value;
+        }
+        size_t shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + ((value >> shift) & (SUB_COUNT - 1));
+    }
+    static uint64_t upperBound(size_t idx)
+    {
+        if (idx < SUB_COUNT)
+        {
+            return idx;
+        }
+        size_t shift = (idx >> SUB_BITS) - 1;
+        uint64_t lower = (uint64_t)(SUB_COUNT + (idx & (SUB_COUNT - 1))) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _max;
+};
+
+struct BenchCase
+{
+    std::string _mode;   // sync / async
+    std::string _looper; // buffer / ring / staging (同步日志器为"-")
+    std::string _policy; // 溢出策略(只有双缓冲区工作器区分, 其余为"-")
+    std::string _sink;
+    size_t _threads;
+    size_t _msg_len;
+};
+
+struct BenchResult
+{
+    BenchCase _case;
+    size_t _count;       // 实际输出的日志条数
+    double _wall;        // 耗时最长的生产者线程的耗时(秒)
+    double _drain;       // 生产者结束后, 刷新日志器直到落地完成的耗时(秒)
+    uint64_t _p50;       // 单次调用耗时(纳秒)
+    uint64_t _p99;
+    uint64_t _p999;
+    uint64_t _max;
+    uint64_t _mean;
+    uint64_t _dropped;   // 溢出策略丢弃的日志条数
+};
+
+struct BenchConfig
+{
+    std::vector<std::string> _modes = {"sync", "async"};
+    std::vector<std::string> _loopers = {"buffer", "ring", "staging"};
+    std::vector<std::string> _policies = {"safe", "unsafe", "drop_newest", "drop_oldest", "block_timeout", "degrade_sync"};
+    std::vector<std::string> _sinks = {"null", "file", "roll_by_size", "roll_by_time", "mmap_roll", "raw_writev", "raw_uring", "binary"};
+    std::vector<size_t> _threads = {1, 4};
+    std::vector<size_t> _sizes = {64, 256};
+    size_t _count = 100000; // 每次测试输出的日志总条数(平均分配给各个线程)
+    std::string _pattern = "%m%n";
+    std::string _label = "default";
+    std::string _csv;
+    std::string _json;
+};
+
+std::vector<std::string> splitList(const std::string &str)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (item.empty() == false)
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<size_t> splitNumbers(const std::string &str)
+{
+    std::vector<size_t> numbers;
+    for (auto &item : splitList(str))
+    {
+        numbers.push_back(std::stoul(item));
+    }
+    return numbers;
+}
+
+void usage(const char *prog)
+{
+    std::cout << "用法: " << prog << " [选项]\n"
+              << "  --modes sync,async\n"
+              << "  --loopers buffer,ring,staging\n"
+              << "  --policies safe,unsafe,drop_newest,drop_oldest,block_timeout,degrade_sync\n"
+              << "  --sinks null,file,roll_by_size,roll_by_time,mmap_roll,raw_writev,raw_uring,binary\n"
+              << "  --threads 1,4        --sizes 64,256        --count 100000\n"
+              << "  --pattern \"%m%n\"     --label default\n"
+              << "  --csv 文件           --json 文件" << std::endl;
+}
+
+bool parseArgs(int argc, char *argv[], BenchConfig &conf)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string key = argv[i];
+        if (key == "-h" || key == "--help" || i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (key == "--modes")
+            conf._modes = splitList(value);
+        else if (key == "--loopers")
+            conf._loopers = splitList(value);
+        else if (key == "--policies")
+            conf._policies = splitList(value);
+        else if (key == "--sinks")
+            conf._sinks = splitList(value);
+        else if (key == "--threads")
+            conf._threads = splitNumbers(value);
+        else if (key == "--sizes")
+            conf._sizes = splitNumbers(value);
+        else if (key == "--count")
+            conf._count = std::stoul(value);
+        else if (key == "--pattern")
+            conf._pattern = value;
+        else if (key == "--label")
+            conf._label = value;
+        else if (key == "--csv")
+            conf._csv = value;
+        else if (key == "--json")
+            conf._json = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+// 展开所有测试组合: 溢出策略只对双缓冲区工作器有意义
+std::vector<BenchCase> expandCases(const BenchConfig &conf)
+{
+    std::vector<BenchCase> cases;
+    for (auto &mode : conf._modes)
+    {
+        std::vector<std::pair<std::string, std::string>> variants;
+        if (mode == "sync")
+        {
+            variants.emplace_back("-", "-");
+        }
+        else
+        {
+            for (auto &looper : conf._loopers)
+            {
+                if (looper != "buffer")
+                {
+                    variants.emplace_back(looper, "-");
+                    continue;
+                }
+                for (auto &policy : conf._policies)
+                {
+                    variants.emplace_back(looper, policy);
+                }
+            }
+        }
+        for (auto &variant : variants)
+            for (auto &sink : conf._sinks)
+                for (size_t threads : conf._threads)
+                    for (size_t size : conf._sizes)
+                    {
+                        cases.push_back({mode, variant.first, variant.second, sink, threads, size});
+                    }
+    }
+    return cases;
+}
+
+bool buildSink(tjq::LoggerBuilder &builder, const std::string &sink)
+{
+    if (sink == "null")
+        builder.buildSink<tjq::NullSink>();
+    else if (sink == "file")
+        builder.buildSink<tjq::FileSink>(BENCH_DIR "file.log");
+    else if (sink == "roll_by_size")
+        builder.buildSink<tjq::RollBySizeSink>(BENCH_DIR "roll-", 64 * 1024 * 1024);
+    else if (sink == "roll_by_time")
+        builder.buildSink<ext::RollByTimeSink>(BENCH_DIR "time-", ext::TimeGap::GAP_MINUTE);
+    else if (sink == "mmap_roll")
+        builder.buildSink<tjq::MmapRollSink>(BENCH_DIR "mmap-", 64 * 1024 * 1024);
+    else if (sink == "raw_writev")
+        builder.buildSink<tjq::RawFileSink>(BENCH_DIR "writev.log", tjq::FlushPolicy(), tjq::IoMode::IO_WRITEV);
+    else if (sink == "raw_uring")
+        builder.buildSink<tjq::RawFileSink>(BENCH_DIR "uring.log", tjq::FlushPolicy(), tjq::IoMode::IO_URING);
+    else if (sink == "binary")
+        builder.buildSink<tjq::BinaryFileSink>(BENCH_DIR "binary.bin");
+    else
+        return false;
+    return true;
+}
+
+bool buildAsync(tjq::LoggerBuilder &builder, const BenchCase &bc)
+{
+    builder.buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    if (bc._looper == "ring")
+        builder.buildLooperType(tjq::LooperType::LOOPER_RING);
+    else if (bc._looper == "staging")
+        builder.buildLooperType(tjq::LooperType::LOOPER_STAGING);
+    else if (bc._looper != "buffer")
+        return false;
+
+    if (bc._policy == "-" || bc._policy == "safe")
+        builder.buildOverflowPolicy(tjq::AsyncType::ASYNC_SAFE);
+    else if (bc._policy == "unsafe")
+        builder.buildEnableUnSafeAsync();
+    else if (bc._policy == "drop_newest")
+        builder.buildOverflowPolicy(tjq::AsyncType::ASYNC_DROP_NEWEST);
+    else if (bc._policy == "drop_oldest")
+        builder.buildOverflowPolicy(tjq::AsyncType::ASYNC_DROP_OLDEST);
+    else if (bc._policy == "block_timeout")
+        builder.buildOverflowPolicy(tjq::AsyncType::ASYNC_BLOCK_TIMEOUT);
+    else if (bc._policy == "degrade_sync")
+        builder.buildOverflowPolicy(tjq::AsyncType::ASYNC_DEGRADE_SYNC);
+    else
+        return false;
+    return true;
+}
+
+// 删除输出目录中的文件, 避免扫描全部组合时占满磁盘
+void cleanBenchDir()
+{
+    DIR *dir = opendir(BENCH_DIR);
+    if (dir == nullptr)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            ::unlink((std::string(BENCH_DIR) + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+bool runCase(const BenchConfig &conf, const BenchCase &bc, BenchResult &result)
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("bench_logger");
+    builder->buildFormatter(conf._pattern);
+    if (bc._mode == "async")
+    {
+        if (buildAsync(*builder, bc) == false)
+            return false;
+    }
+    else if (bc._mode != "sync")
+    {
+        return false;
+    }
+    if (buildSink(*builder, bc._sink) == false)
+    {
+        return false;
+    }
+    tjq::Logger::ptr logger = builder->build();
+
+    std::string msg(bc._msg_len > 1 ? bc._msg_len - 1 : 0, 'X'); // 少一个字节, 给末尾的换行
+    size_t per_thread = conf._count / bc._threads;
+    std::vector<LatencyHistogram> hists(bc._threads);
+    std::vector<double> costs(bc._threads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < bc._threads; i++)
+    {
+        threads.emplace_back([&, i]()
+                             {
+                                 LatencyHistogram &hist = hists[i];
+                                 auto start = std::chrono::steady_clock::now();
+                                 auto last = start;
+                                 for (size_t j = 0; j < per_thread; j++)
+                                 {
+                                     LOG_INFO(logger, "{}", msg);
+                                     // 相邻两次取时间的间隔作为本次调用的耗时, 每次调用只取一次时间
+                                     auto now = std::chrono::steady_clock::now();
+                                     hist.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+                                     last = now;
+                                 }
+                                 costs[i] = std::chrono::duration<double>(last - start).count(); });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    auto drain_start = std::chrono::steady_clock::now();
+    logger->flush();
+    result._drain = std::chrono::duration<double>(std::chrono::steady_clock::now() - drain_start).count();
+
+    LatencyHistogram total;
+    for (auto &hist : hists)
+    {
+        total.merge(hist);
+    }
+    result._case = bc;
+    result._count = per_thread * bc._threads;
+    result._wall = *std::max_element(costs.begin(), costs.end());
+    result._p50 = total.percentile(50);
+    result._p99 = total.percentile(99);
+    result._p999 = total.percentile(99.9);
+    result._max = total.max();
+    result._mean = total.mean();
+    result._dropped = logger->stats().total()._dropped_records;
+
+    logger.reset();
+    cleanBenchDir();
+    return true;
+}
+
+std::string jsonString(const std::string &str)
+{
+    std::string out = "\"";
+    for (char ch : str)
+    {
+        if (ch == '"' || ch == '\\')
+            out += '\\';
+        if ((unsigned char)ch < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+            out += esc;
+            continue;
+        }
+        out += ch;
+    }
+    return out + "\"";
+}
+
+void writeCsv(const BenchConfig &conf, const std::vector<BenchResult> &results)
+{
+    std::ofstream ofs(conf._csv);
+    ofs << "label,mode,looper,policy,sink,threads,msg_len,count,wall_s,drain_s,msgs_per_sec,mb_per_sec,"
+           "p50_ns,p99_ns,p999_ns,max_ns,mean_ns,dropped\n";
+    for (auto &r : results)
+    {
+        const BenchCase &c = r._case;
+        ofs << conf._label << ',' << c._mode << ',' << c._looper << ',' << c._policy << ',' << c._sink << ','
+            << c._threads << ',' << c._msg_len << ',' << r._count << ',' << r._wall << ',' << r._drain << ','
+            << (size_t)(r._count / r._wall) << ',' << r._count * c._msg_len / r._wall / (1024 * 1024) << ','
+            << r._p50 << ',' << r._p99 << ',' << r._p999 << ',' << r._max << ',' << r._mean << ',' << r._dropped << '\n';
+    }
+}
+
+void writeJson(const BenchConfig &conf, const std::vector<BenchResult> &results)
+{
+    std::ofstream ofs(conf._json);
+    ofs << "{\n  \"label\": " << jsonString(conf._label)
+        << ",\n  \"compiler\": " << jsonString(__VERSION__)
+        << ",\n  \"pattern\": " << jsonString(conf._pattern)
+        << ",\n  \"cpus\": " << std::thread::hardware_concurrency()
+        << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        const BenchCase &c = r._case;
+        ofs << (i == 0 ? "\n" : ",\n")
+            << "    {\"mode\": " << jsonString(c._mode) << ", \"looper\": " << jsonString(c._looper)
+            << ", \"policy\": " << jsonString(c._policy) << ", \"sink\": " << jsonString(c._sink)
+            << ", \"threads\": " << c._threads << ", \"msg_len\": " << c._msg_len << ", \"count\": " << r._count
+            << ", \"wall_s\": " << r._wall << ", \"drain_s\": " << r._drain
+            << ", \"msgs_per_sec\": " << (size_t)(r._count / r._wall)
+            << ", \"p50_ns\": " << r._p50 << ", \"p99_ns\": " << r._p99 << ", \"p999_ns\": " << r._p999
+            << ", \"max_ns\": " << r._max << ", \"mean_ns\": " << r._mean << ", \"dropped\": " << r._dropped << "}";
+    }
+    ofs << "\n  ]\n}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig conf;
+    if (parseArgs(argc, argv, conf) == false)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    tjq::tool::File::createDirectory(BENCH_DIR);
+
+    std::vector<BenchCase> cases = expandCases(conf);
+    std::vector<BenchResult> results;
+    printf("%-5s %-7s %-13s %-12s %3s %5s %12s %9s %8s %8s %8s %10s %8s\n",
+           "mode", "looper", "policy", "sink", "thr", "len", "msgs/s", "drain(s)", "p50", "p99", "p99.9", "max", "dropped");
+    for (auto &bc : cases)
+    {
+        BenchResult r;
+        if (runCase(conf, bc, r) == false)
+        {
+            std::cerr << "无效的测试组合: " << bc._mode << " " << bc._looper << " " << bc._policy << " " << bc._sink << std::endl;
+            return 1;
+        }
+        printf("%-5s %-7s %-13s %-12s %3zu %5zu %12zu %9.3f %8lu %8lu %8lu %10lu %8lu\n",
+               bc._mode.c_str(), bc._looper.c_str(), bc._policy.c_str(), bc._sink.c_str(), bc._threads, bc._msg_len,
+               (size_t)(r._count / r._wall), r._drain, (unsigned long)r._p50, (unsigned long)r._p99,
+               (unsigned long)r._p999, (unsigned long)r._max, (unsigned long)r._dropped);
+        fflush(stdout);
+        results.push_back(r);
+    }
+    if (conf._csv.empty() == false)
+    {
+        writeCsv(conf, results);
+    }
+    if (conf._json.empty() == false)
+    {
+        writeJson(conf, results);
+    }
+    return 0;
+}
@@ -1,6 +1,9 @@
+#include <fstream>
 #include "../logs/Log.h"
+#include "../logs/RawSink.hpp"
 
-void performanceTest(const std::string &logger_name, size_t thr_count, size_t msg_count, size_t msg_len)
+// brace: 使用花括号风格的接口输出日志
+void performanceTest(const std::string &logger_name, size_t thr_count, size_t msg_count, size_t msg_len, bool brace = false)
 {
     // 1. 获取日志器
     tjq::Logger::ptr logger = tjq::getLogger(logger_name);
@@ -24,7 +27,10 @@ void performanceTest(const std::string &logger_name, size_t thr_count, size_t ms
                                  // 5. 开始循环写日志
                                  for (int j = 0; j < msg_per_thr; j++)
                                  {
-                                     logger->fatal("%s", msg.c_str());
+                                     if (brace)
+                                         LOG_FATAL(logger, "{}", msg);
+                                     else
+                                         logger->fatal("%s", msg.c_str());
                                  }
                                  // 6. 线程函数内部结束计时
                                  auto end = std::chrono::high_resolution_clock::now();
@@ -75,10 +81,269 @@ void asyncPerf()
     performanceTest("async_logger", 5, 1000000, 100);
 }
 
+void asyncRingPerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("async_ring_logger");
+    builder->buildFormatter("%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildLooperType(tjq::LooperType::LOOPER_RING); // 使用无锁环形队列工作器
+    builder->buildSink<tjq::FileSink>("./logfile/async_ring.log");
+    builder->build();
+
+    performanceTest("async_ring_logger", 5, 1000000, 100);
+}
+
+void asyncStagingPerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("async_staging_logger");
+    builder->buildFormatter("%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildLooperType(tjq::LooperType::LOOPER_STAGING); // 使用线程暂存区工作器
+    builder->buildSink<tjq::FileSink>("./logfile/async_staging.log");
+    builder->build();
+
+    performanceTest("async_staging_logger", 5, 1000000, 100);
+}
+
+void asyncDeferredPerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("async_deferred_logger");
+    builder->buildFormatter("%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildEnableUnSafeAsync();
+    builder->buildEnableDeferredFormat(); // 日志消息的组织与格式化都在工作线程中完成
+    builder->buildSink<tjq::FileSink>("./logfile/async_deferred.log");
+    builder->build();
+
+    performanceTest("async_deferred_logger", 5, 1000000, 100);
+}
+
+void asyncBracePerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("async_brace_logger");
+    builder->buildFormatter("%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildEnableUnSafeAsync();
+    builder->buildSink<tjq::FileSink>("./logfile/async_brace.log");
+    builder->build();
+
+    performanceTest("async_brace_logger", 5, 1000000, 100, true);
+}
+
+// 分片异步日志器: 不开启非安全模式, 工作线程跟不上时生产者被阻塞, 耗时反映的是落地吞吐量
+void asyncShardPerf()
+{
+    size_t shards[] = {1, 2, 4};
+    for (size_t count : shards)
+    {
+        std::string name = "async_shard_logger_" + std::to_string(count);
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+        builder->buildLoggerName(name);
+        builder->buildFormatter("[%d{%H:%M:%S.%6f}][%t][%c][%f:%l][%p]%T%m%n");
+        builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+        builder->buildEnableDeferredFormat(); // 格式化也由工作线程完成, 工作线程成为瓶颈
+        builder->buildShards(count);
+        builder->buildSink<tjq::RollBySizeSink>("./logfile/" + name + "-", 64 * 1024 * 1024);
+        builder->build();
+
+        std::cout << "分片数量: " << count << std::endl;
+        performanceTest(name, 4, 1000000, 100);
+    }
+}
+
+// 读取本进程累计发起的写系统调用次数(/proc/self/io 中的 syscw)
+size_t writeSyscalls()
+{
+    std::ifstream ifs("/proc/self/io");
+    std::string key;
+    size_t value = 0;
+    while (ifs >> key >> value)
+    {
+        if (key == "syscw:")
+        {
+            return value;
+        }
+    }
+    return 0;
+}
+
+// 文件落地方向对比: 标准库缓冲 / 原始文件描述符writev / io_uring, 同时统计每MB日志的系统调用次数
+void rawSinkPerf()
+{
+    const size_t msg_count = 1000000, msg_len = 100;
+    const char *names[] = {"file_sink", "raw_writev", "raw_uring"};
+    for (int i = 0; i < 3; i++)
+    {
+        std::string name = std::string("async_") + names[i] + "_logger";
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+        builder->buildLoggerName(name);
+        builder->buildFormatter("[%d{%H:%M:%S.%6f}][%t][%c][%f:%l][%p]%T%m%n");
+        builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+        // 每个日志器两个落地方向(完整日志 + 按大小滚动的归档), io_uring可以在一次提交中写完两个文件
+        if (i == 0)
+        {
+            builder->buildSink<tjq::FileSink>("./logfile/" + name + ".log");
+            builder->buildSink<tjq::RollBySizeSink>("./logfile/" + name + "-", 16 * 1024 * 1024);
+        }
+        else
+        {
+            tjq::IoMode mode = i == 1 ? tjq::IoMode::IO_WRITEV : tjq::IoMode::IO_URING;
+            builder->buildSink<tjq::RawFileSink>("./logfile/" + name + ".log", tjq::FlushPolicy(), mode);
+            builder->buildSink<tjq::RawRollBySizeSink>("./logfile/" + name + "-", 16 * 1024 * 1024, tjq::FlushPolicy(), mode);
+        }
+        tjq::Logger::ptr logger = builder->build();
+
+        size_t syscw = writeSyscalls();
+        uint64_t enters = tjq::IoStats::syscalls().load();
+        std::cout << "落地方向: " << names[i] << std::endl;
+        performanceTest(name, 4, msg_count, msg_len);
+        logger->flush();
+        // 原始落地方向自己统计发起的系统调用(syscw不包含io_uring_enter), 标准库缓冲的落地方向使用syscw
+        size_t calls = i == 0 ? writeSyscalls() - syscw : tjq::IoStats::syscalls().load() - enters;
+        std::cout << "每MB日志系统调用次数: " << calls / ((msg_count * msg_len) / (1024.0 * 1024)) << std::endl;
+    }
+}
+
+// 滚动文件落地方向对比: 标准库缓冲写入 / 内存映射写入(同步日志器, 落地耗时直接体现在生产者线程上)
+void mmapRollPerf()
+{
+    const char *names[] = {"roll_by_size", "mmap_roll"};
+    for (int i = 0; i < 2; i++)
+    {
+        std::string name = std::string("sync_") + names[i] + "_logger";
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+        builder->buildLoggerName(name);
+        builder->buildFormatter("%m%n");
+        builder->buildLoggerType(tjq::LoggerType::LOGGER_SYNC);
+        if (i == 0)
+            builder->buildSink<tjq::RollBySizeSink>("./logfile/" + name + "-", 64 * 1024 * 1024);
+        else
+            builder->buildSink<tjq::MmapRollSink>("./logfile/" + name + "-", 64 * 1024 * 1024);
+        builder->build();
+
+        std::cout << "落地方向: " << names[i] << std::endl;
+        performanceTest(name, 1, 2000000, 100);
+    }
+}
+
+// 结构化日志: 纯文本 / 文本 + logfmt字段 / JSON行(同步日志器, 空落地方向, 只比较前端的组织与格式化开销)
+void structuredPerf()
+{
+    const char *names[] = {"text", "logfmt", "json"};
+    const char *patterns[] = {"[%d{%H:%M:%S.%6f}][%c][%p]%m%n", "[%d{%H:%M:%S.%6f}][%c][%p]%m%k%n", "%J%n"};
+    for (int i = 0; i < 3; i++)
+    {
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+        builder->buildLoggerName(std::string("sync_") + names[i] + "_logger");
+        builder->buildFormatter(patterns[i]);
+        builder->buildSink<tjq::NullSink>();
+        tjq::Logger::ptr logger = builder->build();
+
+        std::string nickname = "player \"one\"";
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int count = 0; count < 1000000; count++)
+        {
+            if (i == 0)
+                LOG_INFO(logger, "player {} joined room {} uid {} latency {}", nickname, 1001, count, 12.5);
+            else
+                LOG_INFO(logger, "player joined", tjq::kv("nickname", nickname), tjq::kv("room_id", 1001),
+                         tjq::kv("uid", count), tjq::kv("latency_us", 12.5));
+        }
+        std::chrono::duration<double> cost = std::chrono::high_resolution_clock::now() - start;
+        std::cout << "输出格式: " << names[i] << ", 1000000 条, 耗时: " << cost.count() << " s" << std::endl;
+    }
+}
+
+// 日志器查找: 每次调用getLogger(无锁快照查找 + 拷贝智能指针) / 静态的日志器句柄(只在第一次查找)
+void registryPerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("registry_logger");
+    builder->buildLoggerLevel(tjq::LogLevel::value::WARN); // INFO日志只判断等级, 耗时主要是查找日志器
+    builder->buildSink<tjq::NullSink>();
+    builder->build();
+
+    const size_t thr_count = 8, msg_count = 2000000;
+    for (int i = 0; i < 2; i++)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < thr_count; t++)
+        {
+            threads.emplace_back([i]()
+                                 {
+                                     static tjq::LoggerHandle handle("registry_logger");
+                                     for (size_t j = 0; j < msg_count; j++)
+                                     {
+                                         if (i == 0)
+                                             LOG_INFO(tjq::getLogger("registry_logger"), "{}", j);
+                                         else
+                                             LOG_INFO(handle, "{}", j);
+                                     } });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        std::chrono::duration<double> cost = std::chrono::high_resolution_clock::now() - start;
+        std::cout << (i == 0 ? "getLogger" : "LoggerHandle") << ": " << thr_count << " 线程 x " << msg_count
+                  << " 次, 耗时: " << cost.count() << " s" << std::endl;
+    }
+}
+
+void limitPerf()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("limit_logger");
+    builder->buildSink<tjq::NullSink>();
+    tjq::Logger::ptr logger = builder->build();
+
+    // 几乎所有日志都被抑制, 耗时主要是调用点上的采样/限流判断
+    const size_t thr_count = 8, msg_count = 2000000;
+    for (int i = 0; i < 2; i++)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t t = 0; t < thr_count; t++)
+        {
+            threads.emplace_back([i, &logger]()
+                                 {
+                                     for (size_t j = 0; j < msg_count; j++)
+                                     {
+                                         if (i == 0)
+                                             LOG_INFO_EVERY_N(logger, 1000000, "bad move {}", j);
+                                         else
+                                             LOG_INFO_LIMITED(logger, 10, 10, "bad move {}", j);
+                                     } });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        std::chrono::duration<double> cost = std::chrono::high_resolution_clock::now() - start;
+        std::cout << (i == 0 ? "EVERY_N" : "LIMITED") << ": " << thr_count << " 线程 x " << msg_count
+                  << " 次, 耗时: " << cost.count() << " s" << std::endl;
+    }
+}
+
 int main()
 {
     syncPerf();
     // asyncPerf();
+    // asyncRingPerf();
+    // asyncStagingPerf();
+    // asyncDeferredPerf();
+    // asyncBracePerf();
+    // asyncShardPerf();
+    // rawSinkPerf();
+    // mmapRollPerf();
+    // structuredPerf();
+    // registryPerf();
+    // limitPerf();
 
     return 0;
 }
\ No newline at end of file
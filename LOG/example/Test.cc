@@ -1,6 +1,7 @@
 /*项目实现时的测试用例*/
 
 #include <thread>
+#include <algorithm>
 #include <unistd.h>
 // #include "Tool.hpp"
 // #include "Level.hpp"
@@ -8,6 +9,8 @@
 // #include "Format.hpp"
 // #include "Sink.hpp"
 #include "../extend/TimeSink.hpp"
+#include "../logs/BinarySink.hpp"
+#include "../logs/RawSink.hpp"
 // #include "Logger.hpp"
 // #include "Buffer.hpp"
 #include "../logs/Log.h"
@@ -35,6 +38,33 @@ void testFormat()
     std::cout << str << std::endl;
 }
 
+static constexpr char static_pattern[] = "abc%%def[%d{%H:%M:%S}][%c][%f:%l][%p]%T%m%n";
+void testStaticFormat()
+{
+    tjq::LogMessage msg(tjq::LogLevel::value::INFO, 33, "main.c", "root", "编译期格式化功能测试...");
+    tjq::StaticFormatter<static_pattern> static_fmt; // 格式化规则有误(如"%g")则编译失败
+    tjq::Formatter fmt(static_pattern);
+    std::string str = static_fmt.format(msg);
+    std::cout << str << std::endl;
+    assert(str == fmt.format(msg));
+}
+
+void testBraceFormat()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("brace_logger");
+    builder->buildLoggerLevel(tjq::LogLevel::value::INFO);
+    builder->buildFormatter("[%p]%m%n");
+    tjq::Logger::ptr logger = builder->build();
+
+    int count = 0;
+    std::string user = "tjq";
+    LOG_INFO(logger, "room {} created by {}, {{score}} = {}", 1001, user, 99.5);
+    LOG_DEBUG(logger, "等级未达到, 参数不会求值: {}", ++count); // 占位符数量与参数数量不符则编译失败
+    assert(count == 0);
+    logger->warn(TJQ_FMT("通过日志器接口输出: {}"), true);
+}
+
 void printThreadID()
 {
     std::thread::id this_id = std::this_thread::get_id();
@@ -217,6 +247,352 @@ void testAsyncLogger()
     }
 }
 
+void testOverflowPolicy()
+{
+    // 缓冲区满了之后丢弃最早的日志, 生产者从不阻塞, 工作线程会输出一条"records dropped"提示
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("drop_logger");
+    builder->buildFormatter("[%c][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildOverflowPolicy(tjq::AsyncType::ASYNC_DROP_OLDEST);
+    builder->buildSink<tjq::FileSink>("./logfile/drop.log");
+    tjq::Logger::ptr logger = builder->build();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&logger, i]()
+                             {
+            for (int count = 0; count < 200000; count++)
+            {
+                LOG_INFO(logger, "thread {} 测试日志: {}", i, count);
+            } });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void testShardedLogger()
+{
+    // 4个分片: 每个线程固定写入一个分片, 文件落地方向分别写入 shard.log shard.log.1 shard.log.2 shard.log.3
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("shard_logger");
+    builder->buildFormatter("[%d{%H:%M:%S.%6f}][%t][%c]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildShards(4); // buildShards(4, true) 则按时间归并后全部写入 shard.log
+    builder->buildSink<tjq::FileSink>("./logfile/shard.log");
+    tjq::Logger::ptr logger = builder->build();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&logger, i]()
+                             {
+            for (int count = 0; count < 100000; count++)
+            {
+                LOG_INFO(logger, "thread {} 测试日志: {}", i, count);
+            } });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void testFlushPolicy()
+{
+    // 审计日志: 每批日志刷新到内核, 每100毫秒(或每写入4MB)fsync一次, 一次fsync覆盖整批日志
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("audit_logger");
+    builder->buildFormatter("[%d{%H:%M:%S.%6f}][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildSink<tjq::FileSink>("./logfile/audit.log", tjq::FlushPolicy(tjq::FlushType::FLUSH_FSYNC, 100));
+    tjq::Logger::ptr logger = builder->build();
+
+    for (int count = 0; count < 100000; count++)
+    {
+        LOG_INFO(logger, "用户 {} 完成第 {} 次操作", "tjq", count);
+    }
+    logger->flush(); // 返回时之前的日志都已经写入文件并同步到磁盘
+    std::ifstream ifs("./logfile/audit.log");
+    size_t lines = std::count(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>(), '\n');
+    assert(lines == 100000);
+}
+
+void testRawSink()
+{
+    // 两个落地方向的数据在每批日志结束时一次提交: writev模式每个文件一次系统调用, io_uring模式一共一次
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("raw_logger");
+    builder->buildFormatter("[%d{%H:%M:%S}][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildSink<tjq::RawFileSink>("./logfile/raw.log", tjq::FlushPolicy(), tjq::IoMode::IO_URING);
+    builder->buildSink<tjq::RawRollBySizeSink>("./logfile/raw-roll-", 1024 * 1024, tjq::FlushPolicy(), tjq::IoMode::IO_URING);
+    tjq::Logger::ptr logger = builder->build();
+
+    for (int count = 0; count < 100000; count++)
+    {
+        LOG_INFO(logger, "原始落地方向测试-{}", count);
+    }
+    logger->flush();
+    std::ifstream ifs("./logfile/raw.log");
+    size_t lines = std::count(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>(), '\n');
+    assert(lines == 100000);
+    std::cout << "系统调用次数: " << tjq::IoStats::syscalls() << ", 写入字节数: " << tjq::IoStats::bytes() << std::endl;
+}
+
+void testMmapRollSink()
+{
+    // 每个文件预分配1MB并映射, 写满后切换, 关闭时截断为实际大小
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("mmap_logger");
+    builder->buildFormatter("[%d{%H:%M:%S}][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildSink<tjq::MmapRollSink>("./logfile/mmap-roll-", 1024 * 1024);
+    tjq::Logger::ptr logger = builder->build();
+
+    for (int count = 0; count < 100000; count++)
+    {
+        LOG_INFO(logger, "内存映射落地方向测试-{}", count);
+    }
+}
+
+void testArchive()
+{
+    // 切换下来的文件在后台线程中压缩为.lz4, 最多保留5个旧文件
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("archive_logger");
+    builder->buildFormatter("[%d{%H:%M:%S}][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildSink<tjq::RollBySizeSink>("./logfile/archive/roll-", 1024 * 1024, tjq::FlushPolicy(), tjq::ArchivePolicy(true, 5));
+    builder->buildSink<ext::RollByTimeSink>("./logfile/archive/time-", ext::TimeGap::GAP_SECOND, tjq::FlushPolicy(), tjq::ArchivePolicy(true, 0, 10 * 1024 * 1024));
+    tjq::Logger::ptr logger = builder->build();
+
+    for (int count = 0; count < 500000; count++)
+    {
+        LOG_INFO(logger, "归档测试-{}", count);
+    }
+    logger->flush();
+    tjq::Archiver::instance()->wait(); // 等待后台线程处理完已经切换下来的文件
+}
+
+void testFlightRecorder()
+{
+    // 记录所有等级的日志(包括低于日志器输出等级的DEBUG日志), 崩溃或输出FATAL日志时转储最近的日志
+    tjq::FlightRecorder::instance().enable("./logfile/flight.dump", tjq::LogLevel::value::DEBUG);
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("recorder_logger");
+    builder->buildLoggerLevel(tjq::LogLevel::value::WARN);
+    builder->buildFormatter("[%d{%H:%M:%S}][%c][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildSink<tjq::FileSink>("./logfile/recorder.log");
+    tjq::Logger::ptr logger = builder->build();
+
+    for (int count = 0; count < 10000; count++)
+    {
+        LOG_DEBUG(logger, "房间 {} 第 {} 帧", 1001, count); // 只进入飞行记录器
+    }
+    LOG_FATAL(logger, "房间 {} 状态异常", 1001); // 转储到 ./logfile/flight.dump
+    tjq::FlightRecorder::instance().disable();
+}
+
+void testLoggerStats()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("stats_logger");
+    builder->buildFormatter("[%d{%H:%M:%S}][%c][%p]%m%n");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildShards(2);
+    builder->buildSink<tjq::FileSink>("./logfile/stats.log");
+    tjq::Logger::ptr logger = builder->build();
+
+    // 每秒通过root日志器输出一次所有日志器的统计摘要
+    tjq::LoggerManager::getInstance().reportStats(std::chrono::milliseconds(1000));
+    for (int count = 0; count < 300000; count++)
+    {
+        LOG_INFO(logger, "房间 {} 第 {} 帧", 1001, count);
+    }
+    logger->flush();
+
+    tjq::LoggerStats stats = logger->stats();
+    tjq::LooperStats total = stats.total();
+    std::cout << stats.toString() << std::endl;
+    std::cout << "批次数: " << total._batch_bytes._count << " p99批次大小: " << total._batch_bytes.percentile(99)
+              << "B p99落地耗时: " << stats._sink_latency.percentile(99) << "ns" << std::endl;
+    assert(stats._records == 300000);
+}
+
+void testStructuredLog()
+{
+    // %k 输出logfmt格式的字段, %J 输出整条日志的JSON对象(JSON行)
+    const char *patterns[] = {"[%d{%H:%M:%S}][%c][%p]%m%k%n", "%J%n"};
+    const char *files[] = {"./logfile/kv.log", "./logfile/kv.json"};
+    for (int i = 0; i < 2; i++)
+    {
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+        builder->buildLoggerName("kv_logger");
+        builder->buildFormatter(patterns[i]);
+        builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+        builder->buildEnableDeferredFormat(); // 字段块随日志记录一起交给工作线程
+        builder->buildSink<tjq::StdoutSink>();
+        builder->buildSink<tjq::FileSink>(files[i]);
+        tjq::Logger::ptr logger = builder->build();
+
+        std::string nickname = "玩家\"1\"";
+        LOG_INFO(logger, "玩家 {} 进入房间", nickname, tjq::kv("room_id", 1001), tjq::kv("uid", 42u),
+                 tjq::kv("latency_us", 12.5), tjq::kv("spectator", false), tjq::kv("nickname", nickname));
+        LOG_WARN(logger, "房间已满", tjq::kv("room_id", 1001), tjq::kv("players", 2));
+    }
+}
+
+void testLoggerHandle()
+{
+    // 句柄可以在日志器注册之前定义, 注册之前使用默认日志器
+    static tjq::LoggerHandle handle("handle_logger");
+    LOG_INFO(handle, "日志器 {} 尚未注册", handle.name());
+
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("handle_logger");
+    builder->buildFormatter("[%c][%p]%m%n");
+    builder->build();
+    assert(&*handle == tjq::getLogger("handle_logger").get());
+    LOG_INFO(handle, "日志器 {} 已经注册", handle.name());
+
+    // 同名的日志器不会重复添加
+    builder->buildLoggerName("handle_logger");
+    assert(tjq::LoggerManager::getInstance().addLogger(builder->build()) == false);
+}
+
+void testReconfigure()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::GlobalLoggerBuilder());
+    builder->buildLoggerName("room");
+    builder->buildLoggerLevel(tjq::LogLevel::value::INFO);
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildFormatter("[%c][%p]%m%n");
+    builder->buildSink<tjq::StdoutSink>();
+    tjq::Logger::ptr logger = builder->build();
+    LOG_DEBUG(logger, "DEBUG未打开, 不会输出");
+
+    // 运行期间打开DEBUG, 添加文件落地方向并替换格式化器
+    logger->setLevel(tjq::LogLevel::value::DEBUG);
+    tjq::LogSink::ptr file = tjq::SinkFactory::create<tjq::FileSink>("./logfile/room.log");
+    assert(logger->addSink(file) && logger->addSink(file) == false);
+    logger->setFormatter(std::make_shared<tjq::Formatter>("[%d{%H:%M:%S}][%c][%p]%m%n"));
+    LOG_DEBUG(logger, "同时输出到标准输出与文件");
+    logger->flush();
+    assert(logger->removeSink(file) && logger->sinks().size() == 1);
+    LOG_DEBUG(logger, "只输出到标准输出");
+
+    // 通过等级配置文件调整(watchLevels由后台线程在文件变化后自动调用)
+    std::ofstream("./logfile/levels.conf") << "# logger=level\nroom = warn\n";
+    assert(tjq::LoggerManager::getInstance().applyLevels("./logfile/levels.conf") == 1);
+    LOG_INFO(logger, "等级已调整为WARN, 不会输出");
+    logger->flush();
+}
+
+void testSinkFormatter()
+{
+    // 标准输出使用可读文本, 采集端使用JSON并只接收WARN及以上; 两个文件共用同一个JSON格式化器, 每条日志只格式化一次
+    tjq::Formatter::ptr json = std::make_shared<tjq::Formatter>("%J%n");
+    tjq::LogSink::ptr collector = tjq::SinkFactory::create<tjq::FileSink>("./logfile/collector.json");
+    collector->setFormatter(json);
+    collector->setLevel(tjq::LogLevel::value::WARN);
+    tjq::LogSink::ptr archive = tjq::SinkFactory::create<tjq::FileSink>("./logfile/archive.json");
+    archive->setFormatter(json);
+
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("sink_format_logger");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC); // 格式化在异步工作线程中完成
+    builder->buildFormatter("[%d{%H:%M:%S}][%c][%p]%m%n");
+    builder->buildSink<tjq::StdoutSink>();
+    builder->buildSink(collector);
+    builder->buildSink(archive);
+    tjq::Logger::ptr logger = builder->build();
+    LOG_INFO(logger, "player {} joined", "tom", tjq::kv("room_id", 42));
+    LOG_WARN(logger, "room {} is full", 42, tjq::kv("players", 2));
+    logger->flush();
+}
+
+void testRateLimit()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("limit_logger");
+    builder->buildFormatter("[%c][%p]%m%n");
+    tjq::Logger::ptr logger = builder->build();
+    // 每100条输出1条, 共输出10条, 除第一条外每条都带出被抑制的99条
+    for (int i = 0; i < 1000; i++)
+    {
+        LOG_WARN_EVERY_N(logger, 100, "非法落子: 第{}次", i);
+    }
+    // 每秒最多2条, 允许5条突发: 第一轮输出前5条; 等待令牌补充后, 第二轮输出的第一条带出第一轮被抑制的995条
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            LOG_WARN_LIMITED(logger, 2, 5, "匹配失败: 玩家{}", i);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        WARN_EVERY_N(2, "%s: %d", "printf风格", i);
+    }
+}
+
+void testCoalesce()
+{
+    std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+    builder->buildLoggerName("coalesce_logger");
+    builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+    builder->buildEnableCoalesce();
+    builder->buildFormatter("[%c][%p]%m%n");
+    tjq::Logger::ptr logger = builder->build();
+    // 重连风暴: 同一调用点连续的相同日志只输出第一条, 之后输出一条重复提示
+    for (int i = 0; i < 1000; i++)
+    {
+        LOG_WARN(logger, "连接 {} 断开, 正在重连", 7);
+    }
+    LOG_INFO(logger, "连接 {} 重连成功", 7);
+    // 内容不同的日志不会被合并
+    for (int i = 0; i < 3; i++)
+    {
+        logger->warn("连接 %d 断开, 正在重连", i);
+    }
+    logger->flush();
+}
+
+void testBinarySink()
+{
+    {
+        std::unique_ptr<tjq::LoggerBuilder> builder(new tjq::LocalLoggerBuilder());
+        builder->buildLoggerName("binary_logger");
+        builder->buildLoggerType(tjq::LoggerType::LOGGER_ASYNC);
+        builder->buildSink<tjq::BinaryFileSink>("./logfile/binary.bin");
+        tjq::Logger::ptr logger = builder->build();
+        for (int i = 0; i < 10; i++)
+        {
+            logger->info("二进制日志测试: %d %s %.2f", i, "abc", i * 1.5);
+        }
+    } // 日志器与落地方向析构后, 数据全部写入文件
+
+    // 使用任意格式化规则还原日志 (等同于 ../tools/logdecode ./logfile/binary.bin "[%p]%m%n")
+    std::ifstream ifs("./logfile/binary.bin", std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    tjq::Formatter fmt("[%p]%m%n");
+    tjq::BinaryReader reader(data.data(), data.size());
+    tjq::BinaryReader::Entry entry;
+    while (reader.next(entry))
+    {
+        tjq::LogMessage msg(entry._level, entry._line, entry._file, entry._logger, entry._payload, entry._stamp, entry._tid);
+        msg._fields = entry._fields;
+        std::cout << fmt.format(msg);
+    }
+    assert(reader.bad() == false);
+}
+
 void writeLog()
 {
     tjq::Logger::ptr logger = tjq::LoggerManager::getInstance().getLogger("async_logger");
@@ -302,6 +678,23 @@ int main()
     // testSink();
     // testThread();
     // testFormat();
+    // testStaticFormat();
+    // testBinarySink();
+    // testBraceFormat();
+    // testOverflowPolicy();
+    // testShardedLogger();
+    // testFlushPolicy();
+    // testRawSink();
+    // testMmapRollSink();
+    // testArchive();
+    // testFlightRecorder();
+    // testLoggerStats();
+    // testStructuredLog();
+    // testLoggerHandle();
+    // testReconfigure();
+    // testSinkFormatter();
+    // testRateLimit();
+    // testCoalesce();
 
     return 0;
 }
\ No newline at end of file
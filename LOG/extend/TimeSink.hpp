@@ -20,16 +20,22 @@ namespace ext
     };
 
     /*  扩展一个以时间作为日志文件滚动切换类型的日志落地模块
-        RollByTimeSink(const std::string &basename, TimeGap gap_type);
+        RollByTimeSink(const std::string &basename, TimeGap gap_type, const tjq::FlushPolicy &policy, const tjq::ArchivePolicy &archive);
         basename: 基础文件名
         gap_type: 间隔的时间段(时/分/秒/天)
+        policy: 持久化策略(默认不主动刷新)
+        archive: 归档策略(默认不压缩, 不清理旧文件)
     */
     class RollByTimeSink : public tjq::LogSink
     {
     public:
         // 构造时传入文件名, 并打开文件, 将操作句柄管理起来
-        RollByTimeSink(const std::string &basename, TimeGap gap_type)
-            : _basename(basename)
+        RollByTimeSink(const std::string &basename, TimeGap gap_type, const tjq::FlushPolicy &policy = tjq::FlushPolicy(), const tjq::ArchivePolicy &archive = tjq::ArchivePolicy())
+            : _basename(basename),
+              _gap_type(gap_type),
+              _policy(policy),
+              _file(policy),
+              _archive(archive)
         {
             switch (gap_type)
             {
@@ -49,10 +55,13 @@ namespace ext
                 std::cerr << "RollByTimeSink: 无效的时间间隔类型" << std::endl;
             }
             _cur_gap = getCurGap(); // 获取当前时间段
-            std::string filename = createNewFile();
-            tjq::tool::File::createDirectory(tjq::tool::File::path(filename));
-            _ofs.open(filename, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
+            _pathname = createNewFile();
+            _file.open(_pathname);
+            if (_archive.enabled())
+            {
+                _archiver = tjq::Archiver::instance();
+                _archiver->opened(_pathname);
+            }
         }
 
         // 将日志消息写入到指定文件, 判断当前时间是否是当前文件的时间段, 不是则切换文件
@@ -62,13 +71,26 @@ namespace ext
             if (new_cur != _cur_gap)
             {
                 _cur_gap = new_cur; // 更新_cur_gap
-                _ofs.close();
-                std::string filename = createNewFile();
-                _ofs.open(filename, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
+                std::string old = _pathname;
+                _pathname = createNewFile();
+                _file.open(_pathname); // 关闭原来已经打开的文件, 打开新文件
+                if (_archiver.get() != nullptr && _pathname != old)
+                {
+                    _archiver->opened(_pathname);
+                    _archiver->closed(_basename, old, _archive); // 旧文件交给后台线程归档
+                }
             }
-            _ofs.write(data, len);
-            assert(_ofs.good());
+            _file.write(data, len);
+        }
+        void flush(bool force) override
+        {
+            _file.flush(force);
+        }
+
+        // 分片以 basename + index + "-" 作为基础文件名
+        tjq::LogSink::ptr shard(size_t index) override
+        {
+            return std::make_shared<RollByTimeSink>(_basename + std::to_string(index) + "-", _gap_type, _policy, _archive);
         }
 
     private:
@@ -85,22 +107,27 @@ namespace ext
             struct tm lt;
             localtime_r(&t, &lt);
             std::stringstream filename;
-            filename << _basename;
-            filename << lt.tm_year + 1900;
-            filename << lt.tm_mon + 1;
-            filename << lt.tm_mday;
-            filename << lt.tm_hour;
-            filename << lt.tm_min;
-            filename << lt.tm_sec;
+            filename << _basename << std::setfill('0');
+            filename << std::setw(4) << lt.tm_year + 1900;
+            filename << std::setw(2) << lt.tm_mon + 1;
+            filename << std::setw(2) << lt.tm_mday;
+            filename << std::setw(2) << lt.tm_hour;
+            filename << std::setw(2) << lt.tm_min;
+            filename << std::setw(2) << lt.tm_sec;
             filename << ".log";
             return filename.str();
         }
 
     private:
         std::string _basename;
-        std::ofstream _ofs;
+        TimeGap _gap_type;
+        tjq::FlushPolicy _policy;
+        tjq::LogFile _file;
         size_t _cur_gap;  // 当前是第几个时间段
         size_t _gap_size; // 时间段的大小
+        std::string _pathname; // 当前输出文件名
+        tjq::ArchivePolicy _archive;
+        tjq::Archiver::ptr _archiver;
     };
 }
 
@@ -0,0 +1,565 @@
+#ifndef __M_ARCHIVE_H__
+#define __M_ARCHIVE_H__
+
+/*  滚动文件的归档: 压缩切换下来的旧文件, 并按照保留策略删除最旧的文件
+    1. 归档工作在独立的后台线程中进行(最低的CPU与IO优先级), 不占用日志器的工作线程
+    2. 压缩格式为LZ4帧格式(内置实现, 不依赖外部库), 压缩后的文件可以直接用 lz4 -d 解压
+    3. 保留策略只统计同一个基础文件名下已经切换下来的文件(包括已经压缩的), 正在写入的文件不计入也不会被删除
+*/
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "Tool.hpp"
+
+#define LZ4_BLOCK_SIZE (4 * 1024 * 1024) // LZ4帧中每个数据块的最大大小(与帧描述符中的4MB对应)
+#define LZ4_HASH_LOG 16                  // 压缩时查找匹配的哈希表大小(2^16项)
+#define ARCHIVE_SUFFIX ".lz4"
+
+namespace tjq
+{
+    /*  LZ4帧格式的压缩与解压(块之间相互独立, 不带内容校验)
+        压缩使用贪心匹配, 压缩率低于官方实现的默认级别, 但格式完全兼容
+    */
+    class Lz4
+    {
+    public:
+        Lz4()
+            : _table(1 << LZ4_HASH_LOG)
+        {
+        }
+
+        // 压缩文件src, 写入dst; 失败返回false
+        bool compressFile(const std::string &src, const std::string &dst)
+        {
+            std::ifstream ifs(src, std::ios::binary);
+            std::ofstream ofs(dst, std::ios::binary | std::ios::trunc);
+            if (ifs.is_open() == false || ofs.is_open() == false)
+            {
+                return false;
+            }
+            _in.resize(LZ4_BLOCK_SIZE);
+            _out.resize(bound(LZ4_BLOCK_SIZE) + 4);
+            // 帧头: 魔数 + FLG(版本01, 块独立) + BD(块最大4MB) + 描述符校验
+            unsigned char header[7] = {0x04, 0x22, 0x4D, 0x18, 0x60, 0x70, 0};
+            header[6] = descriptorChecksum(header + 4, 2);
+            ofs.write((const char *)header, sizeof(header));
+            while (true)
+            {
+                ifs.read(&_in[0], LZ4_BLOCK_SIZE);
+                size_t len = ifs.gcount();
+                if (len == 0)
+                {
+                    break;
+                }
+                // 压缩后没有变小的块原样存储(块大小最高位置1)
+                uint32_t size = compressBlock(_in.data(), len, &_out[4]);
+                if (size >= len)
+                {
+                    memcpy(&_out[4], _in.data(), len);
+                    size = len | 0x80000000u;
+                }
+                writeLE32(&_out[0], size);
+                ofs.write(_out.data(), 4 + (size & 0x7FFFFFFFu));
+            }
+            char end_mark[4] = {0, 0, 0, 0};
+            ofs.write(end_mark, 4);
+            return ifs.bad() == false && ofs.good();
+        }
+
+        // 解压LZ4帧格式的数据(仅支持本类写入的块独立格式), 失败返回false
+        static bool decompress(const char *data, size_t len, std::string &out)
+        {
+            const unsigned char *ptr = (const unsigned char *)data, *end = ptr + len;
+            if (len < 7 || readLE32(ptr) != 0x184D2204u || (ptr[4] & 0xC8) != 0x40)
+            {
+                return false;
+            }
+            ptr += 7;
+            while (end - ptr >= 4)
+            {
+                uint32_t size = readLE32(ptr);
+                ptr += 4;
+                if (size == 0)
+                {
+                    return true;
+                }
+                size_t block = size & 0x7FFFFFFFu;
+                if ((size_t)(end - ptr) < block)
+                {
+                    return false;
+                }
+                if (size & 0x80000000u)
+                {
+                    out.append((const char *)ptr, block);
+                }
+                else if (decompressBlock(ptr, block, out) == false)
+                {
+                    return false;
+                }
+                ptr += block;
+            }
+            return false;
+        }
+
+    private:
+        static size_t bound(size_t len)
+        {
+            return len + len / 255 + 16;
+        }
+        static uint32_t readLE32(const void *ptr)
+        {
+            const unsigned char *p = (const unsigned char *)ptr;
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+        static void writeLE32(char *ptr, uint32_t value)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                ptr[i] = (char)(value >> (i * 8));
+            }
+        }
+        static uint32_t read32(const unsigned char *ptr)
+        {
+            uint32_t value;
+            memcpy(&value, ptr, 4);
+            return value;
+        }
+        // 帧描述符校验: XXH32(描述符, seed=0)的第二个字节(描述符不足16字节, 只需要XXH32的短输入分支)
+        static unsigned char descriptorChecksum(const unsigned char *ptr, size_t len)
+        {
+            const uint32_t PRIME1 = 2654435761u, PRIME2 = 2246822519u, PRIME3 = 3266489917u, PRIME5 = 374761393u;
+            uint32_t h = PRIME5 + (uint32_t)len;
+            for (size_t i = 0; i < len; i++)
+            {
+                h += ptr[i] * PRIME5;
+                h = ((h << 11) | (h >> 21)) * PRIME1;
+            }
+            h ^= h >> 15;
+            h *= PRIME2;
+            h ^= h >> 13;
+            h *= PRIME3;
+            h ^= h >> 16;
+            return (unsigned char)(h >> 8);
+        }
+
+        // 写入一个序列: 字面量长度/匹配长度令牌 + 扩展长度 + 字面量 + 偏移 + 扩展长度
+        static char *writeSequence(char *op, const unsigned char *literal, size_t lit_len, size_t offset, size_t match_len)
+        {
+            unsigned char *token = (unsigned char *)op++;
+            *token = (unsigned char)(std::min(lit_len, (size_t)15) << 4);
+            if (lit_len >= 15)
+            {
+                size_t rest = lit_len - 15;
+                for (; rest >= 255; rest -= 255)
+                {
+                    *op++ = (char)255;
+                }
+                *op++ = (char)rest;
+            }
+            memcpy(op, literal, lit_len);
+            op += lit_len;
+            if (offset == 0)
+            {
+                return op; // 最后一个序列只有字面量
+            }
+            *op++ = (char)(offset & 0xFF);
+            *op++ = (char)(offset >> 8);
+            size_t ml = match_len - 4;
+            *token |= (unsigned char)std::min(ml, (size_t)15);
+            if (ml >= 15)
+            {
+                size_t rest = ml - 15;
+                for (; rest >= 255; rest -= 255)
+                {
+                    *op++ = (char)255;
+                }
+                *op++ = (char)rest;
+            }
+            return op;
+        }
+
+        // 压缩一个独立的块, 返回压缩后的大小(dst至少需要bound(len)字节)
+        uint32_t compressBlock(const char *src, size_t len, char *dst)
+        {
+            const unsigned char *base = (const unsigned char *)src, *ip = base, *anchor = base, *end = base + len;
+            char *op = dst;
+            // 格式要求: 最后5个字节必须是字面量, 最后一个匹配必须在结尾12字节之前开始
+            if (len >= 13)
+            {
+                std::fill(_table.begin(), _table.end(), 0);
+                const unsigned char *mflimit = end - 12, *matchlimit = end - 5;
+                while (ip < mflimit)
+                {
+                    uint32_t seq = read32(ip);
+                    uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+                    const unsigned char *ref = base + _table[h];
+                    _table[h] = (uint32_t)(ip - base);
+                    if (ref >= ip || ip - ref > 65535 || read32(ref) != seq)
+                    {
+                        ip++;
+                        continue;
+                    }
+                    const unsigned char *mp = ip + 4, *rp = ref + 4;
+                    while (mp < matchlimit && *mp == *rp)
+                    {
+                        mp++, rp++;
+                    }
+                    op = writeSequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+                    ip = anchor = mp;
+                }
+            }
+            op = writeSequence(op, anchor, end - anchor, 0, 0);
+            return (uint32_t)(op - dst);
+        }
+
+        static bool decompressBlock(const unsigned char *ptr, size_t len, std::string &out)
+        {
+            const unsigned char *end = ptr + len;
+            while (ptr < end)
+            {
+                unsigned token = *ptr++;
+                size_t lit_len = token >> 4;
+                if (lit_len == 15)
+                {
+                    unsigned char c;
+                    do
+                    {
+                        if (ptr >= end)
+                            return false;
+                        c = *ptr++;
+                        lit_len += c;
+                    } while (c == 255);
+                }
+                if ((size_t)(end - ptr) < lit_len)
+                {
+                    return false;
+                }
+                out.append((const char *)ptr, lit_len);
+                ptr += lit_len;
+                if (ptr == end)
+                {
+                    return true;
+                }
+                if (end - ptr < 2)
+                {
+                    return false;
+                }
+                size_t offset = ptr[0] | (ptr[1] << 8);
+                ptr += 2;
+                size_t match_len = (token & 0x0F) + 4;
+                if ((token & 0x0F) == 15)
+                {
+                    unsigned char c;
+                    do
+                    {
+                        if (ptr >= end)
+                            return false;
+                        c = *ptr++;
+                        match_len += c;
+                    } while (c == 255);
+                }
+                if (offset == 0 || offset > out.size())
+                {
+                    return false;
+                }
+                // 匹配可能与自身重叠, 逐字节复制
+                size_t from = out.size() - offset;
+                for (size_t i = 0; i < match_len; i++)
+                {
+                    out.push_back(out[from + i]);
+                }
+            }
+            return true;
+        }
+
+    private:
+        std::vector<uint32_t> _table; // 4字节序列的哈希 -> 在块中最近出现的位置
+        std::vector<char> _in;
+        std::vector<char> _out;
+    };
+
+    /*  归档策略
+        ArchivePolicy(bool compress, size_t max_files, size_t max_bytes);
+        compress: 切换下来的文件是否压缩
+        max_files: 最多保留的旧文件数量(0表示不限制)
+        max_bytes: 旧文件最多占用的磁盘空间(0表示不限制)
+    */
+    struct ArchivePolicy
+    {
+        ArchivePolicy(bool compress = false, size_t max_files = 0, size_t max_bytes = 0)
+            : _compress(compress),
+              _max_files(max_files),
+              _max_bytes(max_bytes)
+        {
+        }
+        bool enabled() const
+        {
+            return _compress || _max_files > 0 || _max_bytes > 0;
+        }
+
+        bool _compress;
+        size_t _max_files;
+        size_t _max_bytes;
+    };
+
+    /*  归档器: 进程内唯一的后台线程, 由启用了归档策略的落地方向共同持有
+        1. 落地方向打开新文件时登记(opened), 切换文件后提交旧文件(closed)
+        2. 后台线程依次压缩提交的文件(压缩完成后删除原文件), 再按照保留策略清理同一基础文件名下最旧的文件
+        3. 最后一个持有者释放时, 处理完已经提交的文件后退出
+    */
+    class Archiver
+    {
+    public:
+        using ptr = std::shared_ptr<Archiver>;
+        static Archiver::ptr instance()
+        {
+            static std::mutex mutex;
+            static std::weak_ptr<Archiver> current;
+            std::unique_lock<std::mutex> lock(mutex);
+            Archiver::ptr archiver = current.lock();
+            if (archiver.get() == nullptr)
+            {
+                archiver.reset(new Archiver());
+                current = archiver;
+            }
+            return archiver;
+        }
+        ~Archiver()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cond.notify_all();
+            _thread.join();
+        }
+
+        // 登记正在写入的文件, 保留策略不会删除它
+        void opened(const std::string &pathname)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _active.insert(pathname);
+        }
+        // 提交切换下来的旧文件
+        void closed(const std::string &basename, const std::string &pathname, const ArchivePolicy &policy)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _active.erase(pathname);
+                _jobs.push_back(Job{basename, pathname, policy});
+            }
+            _cond.notify_all();
+        }
+        // 等待已经提交的文件全部处理完毕
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond_idle.wait(lock, [&]()
+                            { return _jobs.empty() && _busy == false; });
+        }
+
+    private:
+        struct Job
+        {
+            std::string _basename;
+            std::string _pathname;
+            ArchivePolicy _policy;
+        };
+        struct Segment
+        {
+            std::string _pathname;
+            struct timespec _mtime;
+            size_t _size;
+        };
+
+        Archiver()
+            : _stop(false),
+              _busy(false),
+              _thread(std::bind(&Archiver::threadEntry, this))
+        {
+        }
+
+        void threadEntry()
+        {
+            // 后台线程使用最低的CPU优先级与空闲IO调度类, 只在系统空闲时占用资源
+            pid_t tid = (pid_t)syscall(SYS_gettid);
+            setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+            syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+            while (true)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _busy = false;
+                    if (_jobs.empty())
+                    {
+                        _cond_idle.notify_all();
+                    }
+                    _cond.wait(lock, [&]()
+                               { return _stop || _jobs.empty() == false; });
+                    if (_jobs.empty())
+                    {
+                        break;
+                    }
+                    job = std::move(_jobs.front());
+                    _jobs.erase(_jobs.begin());
+                    _busy = true;
+                }
+                if (job._policy._compress)
+                {
+                    compress(job._pathname);
+                }
+                if (job._policy._max_files > 0 || job._policy._max_bytes > 0)
+                {
+                    retain(job._basename, job._policy);
+                }
+            }
+        }
+
+        // 压缩为 pathname.lz4 (先写入临时文件, 完成后改名), 保留原文件的修改时间, 最后删除原文件
+        void compress(const std::string &pathname)
+        {
+            struct stat st;
+            if (stat(pathname.c_str(), &st) < 0)
+            {
+                return;
+            }
+            std::string target = pathname + ARCHIVE_SUFFIX, temp = target + ".tmp";
+            if (_lz4.compressFile(pathname, temp) == false)
+            {
+                std::cerr << "Archive.hpp::Archiver::compress: compress " << pathname << " failed!" << std::endl;
+                unlink(temp.c_str());
+                return;
+            }
+            struct timespec times[2] = {st.st_atim, st.st_mtim};
+            utimensat(AT_FDCWD, temp.c_str(), times, 0);
+            if (rename(temp.c_str(), target.c_str()) < 0)
+            {
+                unlink(temp.c_str());
+                return;
+            }
+            unlink(pathname.c_str());
+        }
+
+        // 清理基础文件名下最旧的文件: 只处理滚动文件生成的文件名, 按修改时间排序
+        void retain(const std::string &basename, const ArchivePolicy &policy)
+        {
+            size_t pos = basename.find_last_of("/\\");
+            std::string dir = pos == std::string::npos ? "." : basename.substr(0, pos + 1);
+            std::string prefix = pos == std::string::npos ? basename : basename.substr(pos + 1);
+            std::vector<Segment> segments;
+            DIR *dp = opendir(dir.c_str());
+            if (dp == nullptr)
+            {
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                struct dirent *entry;
+                while ((entry = readdir(dp)) != nullptr)
+                {
+                    std::string name = entry->d_name;
+                    if (segment(name, prefix) == false)
+                    {
+                        continue;
+                    }
+                    std::string pathname = pos == std::string::npos ? name : dir + name;
+                    struct stat st;
+                    if (_active.count(pathname) > 0 || stat(pathname.c_str(), &st) < 0)
+                    {
+                        continue;
+                    }
+                    segments.push_back(Segment{pathname, st.st_mtim, (size_t)st.st_size});
+                }
+            }
+            closedir(dp);
+            std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b)
+                      {
+                          if (a._mtime.tv_sec != b._mtime.tv_sec)
+                              return a._mtime.tv_sec < b._mtime.tv_sec;
+                          if (a._mtime.tv_nsec != b._mtime.tv_nsec)
+                              return a._mtime.tv_nsec < b._mtime.tv_nsec;
+                          return a._pathname < b._pathname; });
+            size_t total = 0;
+            for (auto &seg : segments)
+            {
+                total += seg._size;
+            }
+            for (size_t i = 0, count = segments.size(); i < segments.size(); i++, count--)
+            {
+                if ((policy._max_files == 0 || count <= policy._max_files) &&
+                    (policy._max_bytes == 0 || total <= policy._max_bytes))
+                {
+                    break;
+                }
+                unlink(segments[i]._pathname.c_str());
+                total -= segments[i]._size;
+            }
+        }
+
+        /*  是否是基础文件名下的滚动文件: 基础文件名 + 14位时间 + ["-" + 序号] + ".log"(或".log.lz4")
+            分片的基础文件名是 基础文件名 + 分片编号 + "-", 必须完整匹配, 否则分片0会把其他分片的文件当作自己的
+        */
+        static bool segment(const std::string &name, const std::string &prefix)
+        {
+            if (name.compare(0, prefix.size(), prefix) != 0)
+            {
+                return false;
+            }
+            size_t pos = prefix.size(), digits = 0;
+            while (pos < name.size() && isdigit((unsigned char)name[pos]))
+            {
+                pos++, digits++;
+            }
+            if (digits != 14)
+            {
+                return false;
+            }
+            if (pos < name.size() && name[pos] == '-')
+            {
+                digits = 0;
+                while (++pos < name.size() && isdigit((unsigned char)name[pos]))
+                {
+                    digits++;
+                }
+                if (digits == 0)
+                {
+                    return false;
+                }
+            }
+            std::string rest = name.substr(pos);
+            return rest == ".log" || rest == ".log" ARCHIVE_SUFFIX;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cond;      // 有新的文件提交
+        std::condition_variable _cond_idle; // 提交的文件全部处理完毕
+        std::vector<Job> _jobs;
+        std::unordered_set<std::string> _active; // 正在写入的文件
+        bool _stop;
+        bool _busy;
+        Lz4 _lz4;
+        std::thread _thread; // 最后初始化, 线程启动时其余成员都已经构造完成
+    };
+}
+
+#endif
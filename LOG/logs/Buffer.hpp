@@ -3,8 +3,10 @@
 
 /*实现异步日志缓冲区*/
 
+#include <atomic>
 #include <vector>
 #include <cassert>
+#include <cstring>
 #include "Tool.hpp"
 
 namespace tjq
@@ -16,8 +18,8 @@ namespace tjq
     class Buffer
     {
     public:
-        Buffer()
-            : _buffer(DEFAULT_BUFFER_SIZE),
+        Buffer(size_t size = DEFAULT_BUFFER_SIZE)
+            : _buffer(size),
               _writer_idx(0),
               _reader_idx(0)
         {
@@ -34,12 +36,39 @@ namespace tjq
             moveWriter(len);
         }
 
+        // 预留至少len字节的可写空间, 返回可写位置的起始地址, 写入完成后通过moveWriter提交
+        char *reserve(size_t len)
+        {
+            ensureEnoughSize(len);
+            return &_buffer[_writer_idx];
+        }
+
+        // 对写指针进行向后偏移操作
+        void moveWriter(size_t len)
+        {
+            assert(len + _writer_idx <= _buffer.size());
+            _writer_idx += len;
+        }
+
         // 返回可读数据的起始地址
         const char *begin()
         {
             return &_buffer[_reader_idx];
         }
 
+        // 返回可读数据的起始地址(可修改已写入的数据)
+        char *data()
+        {
+            return &_buffer[_reader_idx];
+        }
+
+        // 将可读数据截断为前len字节
+        void truncate(size_t len)
+        {
+            assert(len <= readAbleSize());
+            _writer_idx = _reader_idx + len;
+        }
+
         // 对读指针进行向后偏移操作
         void moveReader(size_t len)
         {
@@ -69,6 +98,18 @@ namespace tjq
             _reader_idx = 0; // 与_writer_idx相等表示没有数据可读
         }
 
+        // 丢弃已读数据, 将剩余数据移动到缓冲区起始位置, 腾出可写空间
+        void compact()
+        {
+            size_t len = readAbleSize();
+            if (_reader_idx != 0 && len != 0)
+            {
+                memmove(&_buffer[0], &_buffer[_reader_idx], len);
+            }
+            _reader_idx = 0;
+            _writer_idx = len;
+        }
+
         // 对Buffer实现交换操作
         void swap(Buffer &buffer)
         {
@@ -83,6 +124,18 @@ namespace tjq
             return (_reader_idx == _writer_idx);
         }
 
+        // 缓冲区当前的总空间大小
+        size_t capacity()
+        {
+            return _buffer.size();
+        }
+
+        // 进程内所有缓冲区累计的扩容次数
+        static uint64_t growths()
+        {
+            return growthCounter().load(std::memory_order_relaxed);
+        }
+
     private:
         // 对空间进行扩容
         void ensureEnoughSize(size_t len)
@@ -101,13 +154,12 @@ namespace tjq
                 new_size = _buffer.size() + INCREMENT_BUFFER_SIZE + len; // 否则线性增长
             }
             _buffer.resize(new_size);
+            growthCounter().fetch_add(1, std::memory_order_relaxed);
         }
-
-        // 对写指针进行向后偏移操作
-        void moveWriter(size_t len)
+        static std::atomic<uint64_t> &growthCounter()
         {
-            assert(len + _writer_idx <= _buffer.size());
-            _writer_idx += len;
+            static std::atomic<uint64_t> count(0);
+            return count;
         }
 
     private:
@@ -0,0 +1,406 @@
+#ifndef __M_FIELDS_H__
+#define __M_FIELDS_H__
+
+/*  结构化日志字段(键值对)
+    1. 通过花括号风格的接口附加在日志上: LOG_INFO(logger, "player {} joined", name, tjq::kv("room_id", rid), tjq::kv("latency_us", 12.5));
+       字段必须放在所有占位符参数之后, 不参与消息字符串的组织
+    2. 字段按类型编码为紧凑的字段块, 随日志消息/日志记录/二进制日志文件一起传递, 格式化时才渲染为文本
+       字段块: 依次存放 [类型(1字节)][键长度(1字节)][键][值]
+               INT: zigzag varint    UINT: varint    DOUBLE: 8字节原始数据    BOOL_TRUE/BOOL_FALSE: 没有值    STRING: [长度(varint)][数据]
+    3. 渲染: logfmt(key=value, 必要时加引号转义) 或 JSON对象成员("key":value)
+    4. JSON字符串转义: 按16字节一组扫描需要转义的字符(SSE2), 不需要转义的连续片段整段拷贝
+*/
+
+#include <cmath>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+#include "Buffer.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define FIELDS_MAX_SIZE 65535 // 单条日志字段块的最大长度(日志记录头中以16位保存), 超出的字段被丢弃
+
+namespace tjq
+{
+    // 一个键值对字段, 由tjq::kv创建; 数值按值保存, 其余类型只引用调用方的对象(在日志语句结束前有效)
+    template <typename T>
+    struct Field
+    {
+        std::string_view _key;
+        std::conditional_t<std::is_arithmetic<T>::value, T, const T &> _value;
+    };
+
+    template <typename T>
+    inline Field<T> kv(std::string_view key, const T &value)
+    {
+        return Field<T>{key, value};
+    }
+
+    template <typename T>
+    struct IsField : std::false_type
+    {
+    };
+    template <typename T>
+    struct IsField<Field<T>> : std::true_type
+    {
+    };
+
+    namespace fields
+    {
+        enum class Type : uint8_t
+        {
+            INT = 1,
+            UINT,
+            DOUBLE,
+            BOOL_TRUE,
+            BOOL_FALSE,
+            STRING
+        };
+
+        // 解码后的单个字段, 字符串引用字段块中的数据
+        struct View
+        {
+            std::string_view _key;
+            Type _type;
+            int64_t _int;
+            uint64_t _uint;
+            double _double;
+            std::string_view _str;
+        };
+
+        inline void putVarint(Buffer &out, uint64_t val)
+        {
+            char *ptr = out.reserve(10);
+            size_t len = 0;
+            while (val >= 0x80)
+            {
+                ptr[len++] = (char)(val | 0x80);
+                val >>= 7;
+            }
+            ptr[len++] = (char)val;
+            out.moveWriter(len);
+        }
+
+        inline void putKey(Buffer &out, Type type, std::string_view key)
+        {
+            uint8_t head[2] = {(uint8_t)type, (uint8_t)(key.size() > 255 ? 255 : key.size())};
+            out.push((const char *)head, 2);
+            out.push(key.data(), head[1]);
+        }
+
+        inline void putInt(Buffer &out, std::string_view key, int64_t val)
+        {
+            putKey(out, Type::INT, key);
+            putVarint(out, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+        }
+        inline void putUint(Buffer &out, std::string_view key, uint64_t val)
+        {
+            putKey(out, Type::UINT, key);
+            putVarint(out, val);
+        }
+        inline void putDouble(Buffer &out, std::string_view key, double val)
+        {
+            putKey(out, Type::DOUBLE, key);
+            out.push((const char *)&val, sizeof(val));
+        }
+        inline void putBool(Buffer &out, std::string_view key, bool val)
+        {
+            putKey(out, val ? Type::BOOL_TRUE : Type::BOOL_FALSE, key);
+        }
+        inline void putString(Buffer &out, std::string_view key, std::string_view val)
+        {
+            putKey(out, Type::STRING, key);
+            putVarint(out, val.size());
+            out.push(val.data(), val.size());
+        }
+
+        // 逐个读取字段块中的字段; 字段块可能来自文件, 数据不完整时停止读取
+        class Reader
+        {
+        public:
+            Reader(std::string_view data)
+                : _ptr(data.data()),
+                  _end(data.data() + data.size())
+            {
+            }
+            bool next(View &view)
+            {
+                if (_end - _ptr < 2)
+                {
+                    return false;
+                }
+                view._type = (Type)*_ptr;
+                size_t klen = (uint8_t)_ptr[1];
+                _ptr += 2;
+                if ((size_t)(_end - _ptr) < klen)
+                {
+                    return fail();
+                }
+                view._key = std::string_view(_ptr, klen);
+                _ptr += klen;
+                uint64_t val = 0;
+                switch (view._type)
+                {
+                case Type::INT:
+                    if (getVarint(val) == false)
+                        return fail();
+                    view._int = (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+                    return true;
+                case Type::UINT:
+                    if (getVarint(val) == false)
+                        return fail();
+                    view._uint = val;
+                    return true;
+                case Type::DOUBLE:
+                    if ((size_t)(_end - _ptr) < sizeof(double))
+                        return fail();
+                    memcpy(&view._double, _ptr, sizeof(double));
+                    _ptr += sizeof(double);
+                    return true;
+                case Type::BOOL_TRUE:
+                case Type::BOOL_FALSE:
+                    return true;
+                case Type::STRING:
+                    if (getVarint(val) == false || val > (uint64_t)(_end - _ptr))
+                        return fail();
+                    view._str = std::string_view(_ptr, val);
+                    _ptr += val;
+                    return true;
+                }
+                return fail();
+            }
+            // 已经读取的完整字段之后的位置
+            const char *position() const
+            {
+                return _ptr;
+            }
+
+        private:
+            bool getVarint(uint64_t &val)
+            {
+                val = 0;
+                for (int shift = 0; _ptr < _end && shift < 64; shift += 7)
+                {
+                    uint8_t byte = (uint8_t)*_ptr++;
+                    val |= (uint64_t)(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            bool fail()
+            {
+                _ptr = _end;
+                return false;
+            }
+
+        private:
+            const char *_ptr;
+            const char *_end;
+        };
+
+        // 字段块超过max时, 在不超过max的最后一个完整字段处截断
+        inline std::string_view clip(std::string_view data, size_t max)
+        {
+            if (data.size() <= max)
+            {
+                return data;
+            }
+            Reader reader(data);
+            View view;
+            size_t len = 0;
+            while (reader.next(view) && (size_t)(reader.position() - data.data()) <= max)
+            {
+                len = reader.position() - data.data();
+            }
+            return data.substr(0, len);
+        }
+
+        // 数值字段的文本形式; 非有限的浮点数返回false(JSON中输出为null)
+        inline bool number(Buffer &out, const View &view)
+        {
+            char *ptr = out.reserve(32);
+            std::to_chars_result res;
+            if (view._type == Type::INT)
+                res = std::to_chars(ptr, ptr + 32, view._int);
+            else if (view._type == Type::UINT)
+                res = std::to_chars(ptr, ptr + 32, view._uint);
+            else if (std::isfinite(view._double))
+                res = std::to_chars(ptr, ptr + 32, view._double);
+            else
+                return false;
+            out.moveWriter(res.ptr - ptr);
+            return true;
+        }
+    }
+
+    namespace json
+    {
+        // 返回[pos, len)中第一个需要转义的字符('"', '\\', 控制字符)的位置, 没有则返回len
+        inline size_t scan(const char *data, size_t pos, size_t len)
+        {
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i slash = _mm_set1_epi8('\\');
+            const __m128i ctrl = _mm_set1_epi8(0x1f);
+            for (; pos + 16 <= len; pos += 16)
+            {
+                __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+                // 无符号比较: max(c, 0x1f) == 0x1f 即 c <= 0x1f
+                __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+                int mask = _mm_movemask_epi8(hit);
+                if (mask != 0)
+                {
+                    return pos + __builtin_ctz(mask);
+                }
+            }
+#endif
+            for (; pos < len; pos++)
+            {
+                unsigned char c = (unsigned char)data[pos];
+                if (c == '"' || c == '\\' || c < 0x20)
+                {
+                    return pos;
+                }
+            }
+            return len;
+        }
+
+        // 按JSON字符串规则转义后写入缓冲区(不包含两侧的引号), UTF-8字节原样输出
+        inline void escape(Buffer &out, std::string_view str)
+        {
+            static const char hex[] = "0123456789abcdef";
+            size_t pos = 0;
+            while (pos < str.size())
+            {
+                size_t hit = scan(str.data(), pos, str.size());
+                out.push(str.data() + pos, hit - pos);
+                if (hit == str.size())
+                {
+                    break;
+                }
+                unsigned char c = (unsigned char)str[hit];
+                char esc[6] = {'\\', 0, 0, 0, 0, 0};
+                size_t len = 2;
+                switch (c)
+                {
+                case '"':
+                    esc[1] = '"';
+                    break;
+                case '\\':
+                    esc[1] = '\\';
+                    break;
+                case '\n':
+                    esc[1] = 'n';
+                    break;
+                case '\r':
+                    esc[1] = 'r';
+                    break;
+                case '\t':
+                    esc[1] = 't';
+                    break;
+                case '\b':
+                    esc[1] = 'b';
+                    break;
+                case '\f':
+                    esc[1] = 'f';
+                    break;
+                default:
+                    esc[1] = 'u', esc[2] = '0', esc[3] = '0', esc[4] = hex[c >> 4], esc[5] = hex[c & 0xf];
+                    len = 6;
+                }
+                out.push(esc, len);
+                pos = hit + 1;
+            }
+        }
+
+        // 带引号的JSON字符串
+        inline void string(Buffer &out, std::string_view str)
+        {
+            out.push("\"", 1);
+            escape(out, str);
+            out.push("\"", 1);
+        }
+    }
+
+    namespace fields
+    {
+        // 渲染为logfmt: 每个字段之前有一个空格, 值为空或包含空格/'='/'"'/控制字符时加引号转义
+        inline void logfmt(Buffer &out, std::string_view data)
+        {
+            Reader reader(data);
+            View view;
+            while (reader.next(view))
+            {
+                out.push(" ", 1);
+                out.push(view._key.data(), view._key.size());
+                out.push("=", 1);
+                if (view._type == Type::BOOL_TRUE || view._type == Type::BOOL_FALSE)
+                {
+                    std::string_view val = view._type == Type::BOOL_TRUE ? "true" : "false";
+                    out.push(val.data(), val.size());
+                    continue;
+                }
+                if (view._type != Type::STRING)
+                {
+                    if (number(out, view) == false)
+                    {
+                        out.push(std::isnan(view._double) ? "NaN" : view._double > 0 ? "+Inf" : "-Inf",
+                                 std::isnan(view._double) ? 3 : 4);
+                    }
+                    continue;
+                }
+                bool quote = view._str.empty() || json::scan(view._str.data(), 0, view._str.size()) != view._str.size() ||
+                             view._str.find_first_of(" =") != std::string_view::npos;
+                if (quote)
+                {
+                    json::string(out, view._str);
+                }
+                else
+                {
+                    out.push(view._str.data(), view._str.size());
+                }
+            }
+        }
+
+        // 渲染为JSON对象成员: 每个字段之前有一个逗号(,"key":value), 用于追加到已有的对象中
+        inline void json(Buffer &out, std::string_view data)
+        {
+            Reader reader(data);
+            View view;
+            while (reader.next(view))
+            {
+                out.push(",", 1);
+                json::string(out, view._key);
+                out.push(":", 1);
+                switch (view._type)
+                {
+                case Type::BOOL_TRUE:
+                    out.push("true", 4);
+                    break;
+                case Type::BOOL_FALSE:
+                    out.push("false", 5);
+                    break;
+                case Type::STRING:
+                    json::string(out, view._str);
+                    break;
+                default:
+                    if (number(out, view) == false)
+                    {
+                        out.push("null", 4);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
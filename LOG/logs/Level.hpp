@@ -3,9 +3,11 @@
 
 /*  日志等级类的实现:
     1. 定义枚举类, 枚举出日志等级
-    2. 提供转换接口: 将枚举转换为对应字符串
+    2. 提供转换接口: 将枚举转换为对应字符串, 以及将字符串(如配置文件中的等级)转换为枚举
 */
 
+#include <string>
+
 namespace tjq
 {
     class LogLevel
@@ -41,6 +43,24 @@ namespace tjq
             }
             return "UNKNOW";
         }
+
+        // 不区分大小写, 无法识别时返回UNKNOW
+        static LogLevel::value fromString(const std::string &str)
+        {
+            std::string name(str);
+            for (auto &c : name)
+            {
+                c = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+            }
+            for (int i = (int)LogLevel::value::DEBUG; i <= (int)LogLevel::value::OFF; i++)
+            {
+                if (name == toString((LogLevel::value)i))
+                {
+                    return (LogLevel::value)i;
+                }
+            }
+            return LogLevel::value::UNKNOW;
+        }
     };
 }
 
@@ -0,0 +1,86 @@
+#ifndef __M_LIMITER_H__
+#define __M_LIMITER_H__
+
+/*  调用点级别的日志采样与限流: 防止同一个位置在短时间内输出大量相同的日志
+    1. 由Log.h中的宏在调用点定义静态的采样器/限流器对象, 判断只使用原子操作, 不加锁
+    2. 被抑制的日志在判断之后直接返回, 不组织日志消息, 也不进行格式化
+    3. 被抑制的条数累计在调用点上, 由下一条输出的日志带出: "... (N similar records suppressed)"
+*/
+
+#include <atomic>
+#include <cstdint>
+#include "Stats.hpp"
+
+namespace tjq
+{
+    // 采样器: 每n条输出1条(第1条总是输出)
+    class Sampler
+    {
+    public:
+        explicit Sampler(uint64_t n)
+            : _n(n == 0 ? 1 : n),
+              _count(0)
+        {
+        }
+
+        // 返回true表示输出, suppressed为该调用点上一次输出之后被抑制的条数
+        bool pass(uint64_t &suppressed)
+        {
+            uint64_t count = _count.fetch_add(1, std::memory_order_relaxed);
+            if (count % _n != 0)
+            {
+                return false;
+            }
+            suppressed = count == 0 ? 0 : _n - 1;
+            return true;
+        }
+
+    private:
+        uint64_t _n;
+        std::atomic<uint64_t> _count;
+    };
+
+    /*  限流器: 令牌桶, 每秒补充rate个令牌, 最多积累burst个, 每条日志消耗一个令牌
+        以GCRA的形式实现: 只保存下一个令牌的理论到达时间, 一次CAS完成取令牌
+    */
+    class RateLimiter
+    {
+    public:
+        RateLimiter(double rate, uint64_t burst)
+            : _interval(rate > 0 ? (uint64_t)(1000000000 / rate) : UINT64_MAX / 4),
+              _tolerance((burst == 0 ? 1 : burst) * _interval),
+              _tat(0),
+              _suppressed(0)
+        {
+        }
+
+        bool pass(uint64_t &suppressed)
+        {
+            uint64_t now = statsClock();
+            uint64_t tat = _tat.load(std::memory_order_relaxed);
+            while (true)
+            {
+                uint64_t next = (tat > now ? tat : now) + _interval;
+                if (next - now > _tolerance)
+                {
+                    _suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+    private:
+        uint64_t _interval;                  // 补充一个令牌的时间(纳秒)
+        uint64_t _tolerance;                 // 桶容量对应的时间(纳秒)
+        std::atomic<uint64_t> _tat;          // 下一个令牌的理论到达时间
+        std::atomic<uint64_t> _suppressed;   // 上一次输出之后被抑制的条数
+    };
+}
+
+#endif
@@ -4,35 +4,117 @@
 /*  1. 提供获取指定日志器的全局接口(避免用户自己操作单例对象)
     2. 使用宏函数对日志器的接口进行代理(代理模式)
     3. 提供宏函数, 直接通过默认日志器进行日志的标准输出打印(不用获取日志器了)
+    4. 编译期日志等级: 低于TJQ_ACTIVE_LEVEL的宏调用在编译期被移除, 例如 -DTJQ_ACTIVE_LEVEL=TJQ_LEVEL_INFO
+    5. 按调用点采样(每n条输出1条)与限流(令牌桶)的宏函数, 被抑制的条数由该调用点下一条输出的日志带出
 */
 
 #include "Logger.hpp"
 
+// 编译期日志等级, 与LogLevel::value的取值一致
+#define TJQ_LEVEL_DEBUG 1
+#define TJQ_LEVEL_INFO 2
+#define TJQ_LEVEL_WARN 3
+#define TJQ_LEVEL_ERROR 4
+#define TJQ_LEVEL_FATAL 5
+#define TJQ_LEVEL_OFF 6
+
+#ifndef TJQ_ACTIVE_LEVEL
+#define TJQ_ACTIVE_LEVEL TJQ_LEVEL_DEBUG
+#endif
+
 namespace tjq
 {
-// 使用宏函数对日志器的接口进行代理(代理模式)
-#define debug(fmt, ...) debug(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define info(fmt, ...) info(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define warn(fmt, ...) warn(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define error(fmt, ...) error(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define fatal(fmt, ...) fatal(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+    static_assert((int)LogLevel::value::DEBUG == TJQ_LEVEL_DEBUG && (int)LogLevel::value::OFF == TJQ_LEVEL_OFF,
+                  "TJQ_LEVEL_* must match LogLevel::value");
+
+// 使用宏函数对日志器的接口进行代理(代理模式), 每个调用点定义一个静态的调用点描述对象
+#define debug(fmt, ...) debug(TJQ_CALL_SITE(DEBUG, nullptr), fmt, ##__VA_ARGS__)
+#define info(fmt, ...) info(TJQ_CALL_SITE(INFO, nullptr), fmt, ##__VA_ARGS__)
+#define warn(fmt, ...) warn(TJQ_CALL_SITE(WARN, nullptr), fmt, ##__VA_ARGS__)
+#define error(fmt, ...) error(TJQ_CALL_SITE(ERROR, nullptr), fmt, ##__VA_ARGS__)
+#define fatal(fmt, ...) fatal(TJQ_CALL_SITE(FATAL, nullptr), fmt, ##__VA_ARGS__)
+
+// 先进行编译期等级判断(未开启的调用不生成任何代码), 再进行运行时等级判断, 两者都通过后才会对参数求值
+// 方法名加括号, 避免再次被上面的代理宏展开; site_fmt为记录到调用点中的格式化字符串(字面量或nullptr)
+#define TJQ_LOG_CALL(logger, level, method, site_fmt, fmt, ...)                                     \
+    do                                                                                              \
+    {                                                                                               \
+        if constexpr ((int)tjq::LogLevel::value::level >= TJQ_ACTIVE_LEVEL)                         \
+        {                                                                                           \
+            tjq::Logger &tjq_logger_ = *(logger);                                                   \
+            if (tjq_logger_.shouldLog(tjq::LogLevel::value::level))                                 \
+                (tjq_logger_.method)(TJQ_CALL_SITE(level, site_fmt), fmt, ##__VA_ARGS__);           \
+        }                                                                                           \
+    } while (0)
 
 // 提供宏函数, 直接通过默认日志器进行日志的标准输出打印(不用获取日志器了)
-#define DEBUG(fmt, ...) tjq::rootLogger()->debug(fmt, ##__VA_ARGS__)
-#define INFO(fmt, ...) tjq::rootLogger()->info(fmt, ##__VA_ARGS__)
-#define WARN(fmt, ...) tjq::rootLogger()->warn(fmt, ##__VA_ARGS__)
-#define ERROR(fmt, ...) tjq::rootLogger()->error(fmt, ##__VA_ARGS__)
-#define FATAL(fmt, ...) tjq::rootLogger()->fatal(fmt, ##__VA_ARGS__)
+#define DEBUG(fmt, ...) TJQ_LOG_CALL(tjq::rootLogger(), DEBUG, debug, nullptr, fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...) TJQ_LOG_CALL(tjq::rootLogger(), INFO, info, nullptr, fmt, ##__VA_ARGS__)
+#define WARN(fmt, ...) TJQ_LOG_CALL(tjq::rootLogger(), WARN, warn, nullptr, fmt, ##__VA_ARGS__)
+#define ERROR(fmt, ...) TJQ_LOG_CALL(tjq::rootLogger(), ERROR, error, nullptr, fmt, ##__VA_ARGS__)
+#define FATAL(fmt, ...) TJQ_LOG_CALL(tjq::rootLogger(), FATAL, fatal, nullptr, fmt, ##__VA_ARGS__)
+
+// 花括号风格的宏函数: 编译期检查格式化字符串, 日志等级未达到时不会对参数求值
+// LOG_INFO(logger, "room {} created by {}", rid, uid); logger为日志器指针
+#define LOG_FORMAT(logger, level, fmt, ...)                                                         \
+    do                                                                                              \
+    {                                                                                               \
+        tjq::Logger &tjq_logger_ = *(logger);                                                       \
+        if (tjq_logger_.shouldLog(level))                                                           \
+            tjq_logger_.logFormat(level, TJQ_CALL_SITE(UNKNOW, fmt), TJQ_FMT(fmt), ##__VA_ARGS__);  \
+    } while (0)
+#define LOG_DEBUG(logger, fmt, ...) TJQ_LOG_CALL(logger, DEBUG, debug, fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_INFO(logger, fmt, ...) TJQ_LOG_CALL(logger, INFO, info, fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_WARN(logger, fmt, ...) TJQ_LOG_CALL(logger, WARN, warn, fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_ERROR(logger, fmt, ...) TJQ_LOG_CALL(logger, ERROR, error, fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_FATAL(logger, fmt, ...) TJQ_LOG_CALL(logger, FATAL, fatal, fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+
+// 采样与限流: 调用点定义静态的采样器/限流器, 等级判断通过后再判断是否抑制, 被抑制的日志不会对参数求值
+// limiter为Limiter.hpp中的类型名, args为带括号的构造参数
+#define TJQ_LOG_LIMITED(logger, level, limiter, args, site_fmt, fmt, ...)                          \
+    do                                                                                              \
+    {                                                                                               \
+        if constexpr ((int)tjq::LogLevel::value::level >= TJQ_ACTIVE_LEVEL)                         \
+        {                                                                                           \
+            tjq::Logger &tjq_logger_ = *(logger);                                                   \
+            static tjq::limiter tjq_limiter_ args;                                                  \
+            uint64_t tjq_suppressed_ = 0;                                                           \
+            if (tjq_logger_.shouldLog(tjq::LogLevel::value::level) &&                               \
+                tjq_limiter_.pass(tjq_suppressed_))                                                 \
+                tjq_logger_.logSuppressed(tjq::LogLevel::value::level, TJQ_CALL_SITE(level, site_fmt), \
+                                          tjq_suppressed_, fmt, ##__VA_ARGS__);                     \
+        }                                                                                           \
+    } while (0)
+
+// 每n条输出1条: LOG_WARN_EVERY_N(logger, 100, "bad move from {}", uid);
+#define LOG_DEBUG_EVERY_N(logger, n, fmt, ...) TJQ_LOG_LIMITED(logger, DEBUG, Sampler, (n), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_INFO_EVERY_N(logger, n, fmt, ...) TJQ_LOG_LIMITED(logger, INFO, Sampler, (n), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_WARN_EVERY_N(logger, n, fmt, ...) TJQ_LOG_LIMITED(logger, WARN, Sampler, (n), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_ERROR_EVERY_N(logger, n, fmt, ...) TJQ_LOG_LIMITED(logger, ERROR, Sampler, (n), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define DEBUG_EVERY_N(n, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), DEBUG, Sampler, (n), nullptr, fmt, ##__VA_ARGS__)
+#define INFO_EVERY_N(n, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), INFO, Sampler, (n), nullptr, fmt, ##__VA_ARGS__)
+#define WARN_EVERY_N(n, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), WARN, Sampler, (n), nullptr, fmt, ##__VA_ARGS__)
+#define ERROR_EVERY_N(n, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), ERROR, Sampler, (n), nullptr, fmt, ##__VA_ARGS__)
+
+// 每秒最多rate条, 允许burst条突发: LOG_WARN_LIMITED(logger, 10, 20, "bad move from {}", uid);
+#define LOG_DEBUG_LIMITED(logger, rate, burst, fmt, ...) TJQ_LOG_LIMITED(logger, DEBUG, RateLimiter, (rate, burst), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_INFO_LIMITED(logger, rate, burst, fmt, ...) TJQ_LOG_LIMITED(logger, INFO, RateLimiter, (rate, burst), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_WARN_LIMITED(logger, rate, burst, fmt, ...) TJQ_LOG_LIMITED(logger, WARN, RateLimiter, (rate, burst), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define LOG_ERROR_LIMITED(logger, rate, burst, fmt, ...) TJQ_LOG_LIMITED(logger, ERROR, RateLimiter, (rate, burst), fmt, TJQ_FMT(fmt), ##__VA_ARGS__)
+#define DEBUG_LIMITED(rate, burst, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), DEBUG, RateLimiter, (rate, burst), nullptr, fmt, ##__VA_ARGS__)
+#define INFO_LIMITED(rate, burst, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), INFO, RateLimiter, (rate, burst), nullptr, fmt, ##__VA_ARGS__)
+#define WARN_LIMITED(rate, burst, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), WARN, RateLimiter, (rate, burst), nullptr, fmt, ##__VA_ARGS__)
+#define ERROR_LIMITED(rate, burst, fmt, ...) TJQ_LOG_LIMITED(tjq::rootLogger(), ERROR, RateLimiter, (rate, burst), nullptr, fmt, ##__VA_ARGS__)
 
     // 提供获取指定日志器的全局接口(避免用户自己操作单例对象)
-    Logger::ptr getLogger(const std::string &name)
+    inline Logger::ptr getLogger(const std::string &name)
     {
         return tjq::LoggerManager::getInstance().getLogger(name);
     }
-    Logger::ptr rootLogger()
+    inline const Logger::ptr &rootLogger()
     {
         return tjq::LoggerManager::getInstance().rootLogger();
     }
 }
 
-#endif
\ No newline at end of file
+#endif
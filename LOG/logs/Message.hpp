@@ -9,36 +9,71 @@
     5. 线程ID
     6. 日志主体消息
     7. 日志器名称
+    8. 结构化字段(编码后的字段块, 见Fields.hpp)
+    文件名/日志器名称/消息主体/字段块只引用外部数据, 不进行拷贝, 日志消息对象只在一次日志输出过程中有效
+    通过宏函数打印的日志, 文件名与行号来自调用点描述对象(CallSite)
 */
 
 #include <iostream>
 #include <string>
 #include <thread>
+#include <string_view>
 #include "Tool.hpp"
 #include "Level.hpp"
+#include "Site.hpp"
 
 namespace tjq
 {
     struct LogMessage
     {
-        LogMessage(LogLevel::value level, size_t line, const std::string file, const std::string logger, const std::string msg)
-            : _ctime(tool::Date::now()),
+        LogMessage(LogLevel::value level, const CallSite &site, std::string_view logger, std::string_view msg)
+            : LogMessage(level, site._line, site._file, logger, msg)
+        {
+            _site = &site;
+        }
+        LogMessage(LogLevel::value level, const CallSite &site, std::string_view logger, std::string_view msg,
+                   uint64_t stamp, std::thread::id tid)
+            : LogMessage(level, site._line, site._file, logger, msg, stamp, tid)
+        {
+            _site = &site;
+        }
+        LogMessage(LogLevel::value level, size_t line, std::string_view file, std::string_view logger, std::string_view msg)
+            : _stamp(tool::Clock::now()),
+              _ctime((time_t)(_stamp / 1000000000)),
               _level(level),
               _line(line),
               _tid(std::this_thread::get_id()),
+              _site(nullptr),
+              _file(file),
+              _logger(logger),
+              _payload(msg)
+        {
+        }
+        // 由延迟格式化的日志记录还原日志消息时, 时间和线程ID使用记录中保存的值
+        LogMessage(LogLevel::value level, size_t line, std::string_view file, std::string_view logger, std::string_view msg,
+                   uint64_t stamp, std::thread::id tid)
+            : _stamp(stamp),
+              _ctime((time_t)(_stamp / 1000000000)),
+              _level(level),
+              _line(line),
+              _tid(tid),
+              _site(nullptr),
               _file(file),
               _logger(logger),
               _payload(msg)
         {
         }
 
-        time_t _ctime;          // 日志产生的时间戳
-        LogLevel::value _level; // 日志等级
-        size_t _line;           // 行号
-        std::thread::id _tid;   // 线程ID
-        std::string _file;      // 源码文件名
-        std::string _logger;    // 日志器名称
-        std::string _payload;   // 有效消息数据
+        uint64_t _stamp;           // 日志产生的时间(纳秒)
+        time_t _ctime;             // 日志产生的时间戳(秒)
+        LogLevel::value _level;    // 日志等级
+        size_t _line;              // 行号
+        std::thread::id _tid;      // 线程ID
+        const CallSite *_site;     // 调用点(没有则为nullptr)
+        std::string_view _file;    // 源码文件名
+        std::string_view _logger;  // 日志器名称
+        std::string_view _payload; // 有效消息数据
+        std::string_view _fields;  // 结构化字段块(没有字段则为空)
     };
 }
 
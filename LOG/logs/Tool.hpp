@@ -2,7 +2,7 @@
 #define __M_TOOL_H__
 
 /*  实用工具类的实现:
-    1. 获取系统时间
+    1. 获取系统时间(秒级) & 日志时钟(纳秒级)
     2. 判断文件是否存在
     3. 获取文件所在路径
     4. 创建目录
@@ -10,6 +10,9 @@
 
 #include <iostream>
 #include <ctime>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <sys/stat.h>
 
 namespace tjq
@@ -25,6 +28,39 @@ namespace tjq
             }
         };
 
+        /*  日志时钟: 单调时钟 + 系统时间偏移量, 每条日志只读取一次单调时钟
+            1. 得到的是纳秒精度的系统时间(从1970年开始的纳秒数)
+            2. 偏移量每秒校准一次, 使日志时间能跟上系统时间的调整
+        */
+        class Clock
+        {
+        public:
+            static uint64_t now()
+            {
+                int64_t steady = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count();
+                static std::atomic<int64_t> offset(calibrate(steady));
+                static std::atomic<int64_t> last(steady);
+                if (steady - last.load(std::memory_order_relaxed) > 1000000000)
+                {
+                    last.store(steady, std::memory_order_relaxed);
+                    offset.store(calibrate(steady), std::memory_order_relaxed);
+                }
+                return (uint64_t)(steady + offset.load(std::memory_order_relaxed));
+            }
+
+        private:
+            // 计算系统时间与单调时钟之间的偏移量
+            static int64_t calibrate(int64_t steady)
+            {
+                int64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch())
+                                   .count();
+                return wall - steady;
+            }
+        };
+
         class File
         {
         public:
@@ -0,0 +1,92 @@
+/*  二进制日志文件解码工具
+    ./logdecode <binary_log_file>... [pattern]
+    按照指定的格式化规则(默认与Formatter相同)将BinaryFileSink写入的二进制日志还原为文本日志, 输出到标准输出
+    指定多个文件时(例如分片异步日志器写入的 app.bin app.bin.1 app.bin.2 ...), 按日志产生的时间归并后输出
+    包含'%'的最后一个参数作为格式化规则
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "../logs/Logger.hpp"
+#include "../logs/BinarySink.hpp"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <binary_log_file>... [pattern]" << std::endl;
+        return 1;
+    }
+    int files = argc - 1;
+    if (files > 1 && strchr(argv[argc - 1], '%') != nullptr)
+    {
+        files--;
+    }
+    // 1. 读取整个文件, 日志消息中的字符串直接引用文件数据
+    std::vector<std::string> datas(files);
+    for (int i = 0; i < files; i++)
+    {
+        std::ifstream ifs(argv[i + 1], std::ios::binary);
+        if (ifs.is_open() == false)
+        {
+            std::cerr << "open " << argv[i + 1] << " failed!" << std::endl;
+            return 1;
+        }
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        datas[i] = ss.str();
+    }
+
+    // 2. 每个文件各自有序, 每次取出时间最早的一条日志进行格式化, 攒够一批再输出
+    tjq::Formatter::ptr formatter = files < argc - 1 ? std::make_shared<tjq::Formatter>(argv[argc - 1]) : std::make_shared<tjq::Formatter>();
+    std::vector<tjq::BinaryReader> readers;
+    readers.reserve(files); // 日志中的字符串可能引用读取器内部缓冲区, 读取器不能被移动
+    std::vector<tjq::BinaryReader::Entry> entries(files);
+    std::vector<bool> valid(files);
+    for (int i = 0; i < files; i++)
+    {
+        readers.emplace_back(datas[i].data(), datas[i].size());
+        valid[i] = readers[i].next(entries[i]);
+    }
+    tjq::Buffer output;
+    size_t count = 0;
+    while (true)
+    {
+        int cur = -1;
+        for (int i = 0; i < files; i++)
+        {
+            if (valid[i] && (cur < 0 || entries[i]._stamp < entries[cur]._stamp))
+            {
+                cur = i;
+            }
+        }
+        if (cur < 0)
+        {
+            break;
+        }
+        tjq::BinaryReader::Entry &entry = entries[cur];
+        tjq::LogMessage msg(entry._level, entry._line, entry._file, entry._logger, entry._payload, entry._stamp, entry._tid);
+        msg._fields = entry._fields;
+        formatter->format(output, msg);
+        if (output.readAbleSize() >= DEFAULT_BUFFER_SIZE / 2)
+        {
+            fwrite(output.begin(), 1, output.readAbleSize(), stdout);
+            output.reset();
+        }
+        count++;
+        valid[cur] = readers[cur].next(entries[cur]);
+    }
+    fwrite(output.begin(), 1, output.readAbleSize(), stdout);
+    for (int i = 0; i < files; i++)
+    {
+        if (readers[i].bad())
+        {
+            std::cerr << argv[i + 1] << ": corrupted data, " << count << " records decoded" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}